@@ -0,0 +1,170 @@
+// Accept rate benchmark for the server's listening sockets.
+
+// A local flooder opens connections as fast as it can (and drops them right
+// away, like clients reconnecting en masse) while acceptors take them in the
+// way RoboticServer::acceptor does: accept, set no_delay and hand the socket
+// over to a thread of its own. Compares a single listening socket with more
+// of them sharing the port (SO_REUSEPORT), each with its own acceptor pinned
+// to its own CPU, which the kernel spreads the connections across.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/program_options.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+
+using boost::asio::ip::tcp;
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+void pin_to_cpu(size_t cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % std::max(std::thread::hardware_concurrency(), 1u), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Connections accepted per second with this many acceptors.
+double accept_rate(size_t acceptors, size_t flooders, size_t connections)
+{
+  boost::asio::io_context io_ctx;
+  std::vector<tcp::acceptor> listening;
+  tcp::endpoint endpoint{boost::asio::ip::address_v4::loopback(), 0};
+  for (size_t i = 0; i < acceptors; ++i) {
+    tcp::acceptor& acceptor = listening.emplace_back(io_ctx);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address{true});
+    if (acceptors > 1)
+      acceptor.set_option(reuse_port{true});
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    // The rest share the port the first one got.
+    endpoint = acceptor.local_endpoint();
+  }
+
+  std::atomic_size_t accepted = 0;
+  std::atomic_size_t handled = 0;
+  std::atomic_size_t refused = 0;
+  auto start = steady::now();
+  std::vector<std::jthread> threads;
+  for (size_t i = 0; i < acceptors; ++i) {
+    threads.emplace_back([&, i] {
+      if (acceptors > 1)
+        pin_to_cpu(i);
+
+      for (;;) {
+        tcp::socket sock{io_ctx};
+        boost::system::error_code ec;
+        listening[i].accept(sock, ec);
+        // Shut down once all have come.
+        if (ec == boost::asio::error::invalid_argument)
+          return;
+        if (ec)
+          continue;
+
+        sock.set_option(tcp::no_delay{true}, ec);
+        std::thread{[&handled, sock = std::move(sock)] () mutable {
+          sock.close();
+          ++handled;
+        }}.detach();
+        ++accepted;
+      }
+    });
+  }
+
+  for (size_t f = 0; f < flooders; ++f) {
+    threads.emplace_back([&, f] {
+      for (size_t c = f; c < connections; c += flooders) {
+        tcp::socket sock{io_ctx};
+        boost::system::error_code ec;
+        sock.connect(endpoint, ec);
+        if (ec)
+          ++refused;
+        // A reset instead of TIME_WAIT, so that ports do not run out.
+        sock.set_option(boost::asio::socket_base::linger{true, 0}, ec);
+      }
+    });
+  }
+
+  while (accepted + refused < connections)
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+
+  double seconds = std::chrono::duration<double>(steady::now() - start).count();
+  for (tcp::acceptor& acceptor : listening)
+    shutdown(acceptor.native_handle(), SHUT_RDWR);
+  threads.clear();
+  // Handlers use the io_context.
+  while (handled < accepted)
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+
+  if (refused > 0)
+    std::cerr << refused << " connections refused with " << acceptors << " acceptors\n";
+
+  return static_cast<double>(accepted) / seconds;
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    std::vector<size_t> acceptors;
+    size_t flooders;
+    size_t connections;
+
+    po::options_description desc{"Allowed flags for the accept benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("acceptors,a", po::value<std::vector<size_t>>(&acceptors)->multitoken()
+       ->default_value({1, 2, 4}, "1 2 4"), "numbers of acceptors to try")
+      ("flooders,f", po::value<size_t>(&flooders)->default_value(4),
+       "threads opening connections")
+      ("connections,n", po::value<size_t>(&connections)->default_value(10000))
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (flooders == 0)
+      throw std::invalid_argument{"Need a flooder!"};
+
+    std::cout << "acceptors\taccepts/s\n";
+    for (size_t a : acceptors) {
+      if (a == 0)
+        throw std::invalid_argument{"Need an acceptor!"};
+
+      std::cout << a << "\t" << accept_rate(a, flooders, connections) << "\n";
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Benchmark of generating the board at the start of a game.
+
+// Compares the way it was done before (blocks drawn one at a time into a
+// std::set, a BlockPlaced pushed for every draw and the whole turn 0 then
+// serialised from a vector of events) with the bulk generation of GameEngine,
+// which draws all the blocks at once, sorts the repetitions out and encodes
+// turn 0 straight into bytes. Also checks the bulk one gives the same board
+// twice for the same seed.
+
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "marshal.h"
+#include "messages.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+// The way it was done before.
+size_t one_by_one(const GameRules& rules, std::minstd_rand& rand, uint8_t players)
+{
+  server_messages::Turn turn{0, {}};
+  std::map<PlayerId, Position> positions;
+  std::set<Position> blocks;
+  for (PlayerId id = 0; id < players; ++id) {
+    Position pos{static_cast<uint16_t>(rand() % rules.size_x),
+                 static_cast<uint16_t>(rand() % rules.size_y)};
+    positions[id] = pos;
+    turn.second.emplace_back(std::in_place_type<server_messages::PlayerMoved>, id, pos);
+  }
+
+  for (uint16_t i = 0; i < rules.initial_blocks; ++i) {
+    Position pos{static_cast<uint16_t>(rand() % rules.size_x),
+                 static_cast<uint16_t>(rand() % rules.size_y)};
+    blocks.insert(pos);
+    turn.second.emplace_back(std::in_place_type<server_messages::BlockPlaced>, pos);
+  }
+
+  Serialiser ser;
+  ser << server_messages::ServerMessage{turn};
+  return ser.size();
+}
+
+// Microseconds per game start, averaged over the rounds.
+template <typename F>
+double measure(size_t rounds, F&& start)
+{
+  size_t bytes = 0;
+  auto begin = steady::now();
+  for (size_t r = 0; r < rounds; ++r)
+    bytes += start();
+
+  double us = std::chrono::duration<double, std::micro>(steady::now() - begin).count();
+  // Keeps the work from being optimised away.
+  if (bytes == 0)
+    std::cerr << "Nothing generated?\n";
+
+  return us / static_cast<double>(rounds);
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t players;
+    std::vector<uint16_t> initial_blocks;
+    uint32_t seed;
+    size_t rounds;
+
+    po::options_description desc{"Allowed flags for the board benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("size-x,x", po::value<uint16_t>(&size_x)->default_value(1024))
+      ("size-y,y", po::value<uint16_t>(&size_y)->default_value(1024))
+      ("players-count,c", po::value<uint16_t>(&players)->default_value(25))
+      ("initial-blocks,k", po::value<std::vector<uint16_t>>(&initial_blocks)->multitoken()
+       ->default_value({100, 10000, 65535}, "100 10000 65535"),
+       "numbers of initial blocks to try")
+      ("seed,s", po::value<uint32_t>(&seed)->default_value(2137))
+      ("rounds,r", po::value<size_t>(&rounds)->default_value(100),
+       "games started per measurement")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (size_x == 0 || size_y == 0 || players == 0 || players > 255)
+      throw std::invalid_argument{"Bad board size or players count!"};
+
+    std::set<PlayerId> ids;
+    for (uint16_t id = 0; id < players; ++id)
+      ids.insert(static_cast<PlayerId>(id));
+
+    std::cout << "blocks\tone by one us\tbulk us\tspeedup\tdeterministic\n";
+    for (uint16_t k : initial_blocks) {
+      GameRules rules{size_x, size_y, 1, 1, 1, k};
+
+      std::minstd_rand rand{seed};
+      double old_us = measure(rounds, [&] {
+        return one_by_one(rules, rand, static_cast<uint8_t>(players));
+      });
+
+      GameEngine engine{rules, seed};
+      TurnEncoder encoder;
+      double bulk_us = measure(rounds, [&] {
+        encoder.begin(0);
+        engine.start(ids, encoder);
+        return encoder.bytes().size();
+      });
+
+      // Same seed, same board, same bytes.
+      GameEngine first{rules, seed};
+      GameEngine second{rules, seed};
+      TurnEncoder a;
+      TurnEncoder b;
+      a.begin(0);
+      first.start(ids, a);
+      b.begin(0);
+      second.start(ids, b);
+      bool same = a.bytes() == b.bytes();
+
+      std::cout << k << "\t" << old_us << "\t" << bulk_us << "\t"
+                << old_us / bulk_us << "\t" << (same ? "yes" : "NO") << "\n";
+      if (!same)
+        return 1;
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
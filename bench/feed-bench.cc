@@ -0,0 +1,145 @@
+// Benchmark of publishing to the feed with more and more readers.
+
+// The writer publishes turn-sized messages as fast as it can while a number
+// of reader threads follow the feed, each with its own mapping just like a
+// separate process would have. Publishes are timed one by one: the writer
+// never looks at the readers, so their number should not change its cost.
+// How much the readers got and how often they were overrun is reported too.
+
+#include <boost/program_options.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "feed.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+// Messages read and overruns of a reader.
+using ReaderStats = std::pair<uint64_t, uint64_t>;
+
+ReaderStats follow(const std::string& name, const std::atomic_bool& stop)
+{
+  FeedReader feed{name};
+  uint64_t read = 0;
+  uint64_t sum = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    std::optional<std::span<const uint8_t>> bytes = feed.peek();
+    if (!bytes.has_value()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Touch the message as a real reader would.
+    sum += std::accumulate(bytes->begin(), bytes->end(), uint64_t{0});
+    if (feed.done())
+      ++read;
+  }
+
+  // Keep the sum from being optimised away.
+  if (sum == 1)
+    std::cout << "";
+  return {read, feed.overruns()};
+}
+
+void run(const std::string& name, size_t capacity, size_t readers, size_t messages,
+         size_t message_size)
+{
+  FeedWriter feed{name, capacity, std::vector<uint8_t>(16, 0)};
+  std::vector<uint8_t> message(message_size, 3);
+
+  std::atomic_bool stop = false;
+  std::vector<ReaderStats> stats(readers);
+  std::vector<std::jthread> threads;
+  for (size_t r = 0; r < readers; ++r)
+    threads.emplace_back([&name, &stop, &stats, r] { stats[r] = follow(name, stop); });
+
+  std::vector<double> times;
+  times.reserve(messages);
+  for (size_t m = 0; m < messages; ++m) {
+    message[0] = static_cast<uint8_t>(m);
+    auto start = steady::now();
+    feed.publish(message);
+    times.push_back(std::chrono::duration<double, std::nano>(steady::now() - start).count());
+  }
+
+  stop = true;
+  threads.clear();
+
+  std::sort(times.begin(), times.end());
+  auto percentile = [&times] (double p) {
+    return times.at(static_cast<size_t>(p * static_cast<double>(times.size() - 1)));
+  };
+  uint64_t read = 0;
+  uint64_t overruns = 0;
+  for (auto [r, o] : stats) {
+    read += r;
+    overruns += o;
+  }
+  std::cout << readers << "\t" << percentile(0.5) << "\t" << percentile(0.99) << "\t"
+            << (readers > 0 ? read / readers : 0) << "\t" << overruns << "\n";
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    size_t capacity;
+    size_t messages;
+    size_t message_size;
+    std::vector<size_t> readers;
+
+    po::options_description desc{"Allowed flags for the feed benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("capacity", po::value<size_t>(&capacity)->default_value(4 << 20), "bytes of the ring")
+      ("messages,m", po::value<size_t>(&messages)->default_value(1000000), "messages published")
+      ("message-size,s", po::value<size_t>(&message_size)->default_value(400),
+       "bytes of a message, about a busy turn")
+      ("readers,r", po::value<std::vector<size_t>>(&readers)->multitoken()
+       ->default_value({0, 1, 4, 16}, "0 1 4 16"), "reader counts to try")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (messages == 0 || message_size == 0)
+      throw std::invalid_argument{"Nothing to publish!"};
+
+    std::string name = "/feed-bench-" + std::to_string(getpid());
+    std::cout << "readers\tp50 ns\tp99 ns\tread each\toverruns\n";
+    for (size_t r : readers)
+      run(name, capacity, r, messages, message_size);
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Benchmark of the cost of lock profiling.
+
+// A number of threads take the same lock over and over, bumping a counter
+// under it, as the server's threads do with its locks. This is done with a
+// plain std::mutex, with a ProfiledMutex not being profiled (which is how the
+// server runs by default) and with one being profiled. The first two should
+// cost the same. With a single thread nobody ever waits, so it is the cost of
+// the bookkeeping alone.
+
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lock-profile.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+template <typename Mutex>
+double run(Mutex& mutex, size_t threads, size_t acquisitions)
+{
+  uint64_t counter = 0;
+  auto start = steady::now();
+  {
+    std::vector<std::jthread> ths;
+    for (size_t t = 0; t < threads; ++t) {
+      ths.emplace_back([&mutex, &counter, acquisitions] {
+          for (size_t a = 0; a < acquisitions; ++a) {
+            std::lock_guard lk{mutex};
+            ++counter;
+          }
+        });
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(steady::now() - start).count();
+
+  if (counter != threads * acquisitions)
+    throw std::logic_error{"Lost an update under the lock!"};
+  return ns / static_cast<double>(counter);
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    size_t acquisitions;
+    std::vector<size_t> threads;
+
+    po::options_description desc{"Allowed flags for the lock profiling benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("acquisitions,a", po::value<size_t>(&acquisitions)->default_value(2000000),
+       "acquisitions per thread")
+      ("threads,t", po::value<std::vector<size_t>>(&threads)->multitoken()
+       ->default_value({1, 2, 4}, "1 2 4"), "thread counts to try")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (acquisitions == 0)
+      throw std::invalid_argument{"Nothing to acquire!"};
+
+    std::cout << "threads\tstd ns\toff ns\ton ns\tcontended\n";
+    for (size_t t : threads) {
+      if (t == 0)
+        continue;
+
+      std::mutex plain;
+      ProfiledMutex off;
+      ProfiledMutex on;
+      LockProfiler profiler;
+      LockStats& stats = profiler.named("bench");
+      on.profile(stats);
+
+      std::cout << t << "\t" << run(plain, t, acquisitions) << "\t"
+                << run(off, t, acquisitions) << "\t" << run(on, t, acquisitions) << "\t"
+                << stats.contended.load() << "\n";
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
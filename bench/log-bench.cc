@@ -0,0 +1,117 @@
+// Cost of logging as seen by the logging threads.
+
+// A number of threads log lines like the game master does in gather_moves
+// (a string, an address and a number) and the time they spend in the logging
+// calls is measured. The asynchronous logger of dbg.h is compared with the
+// old dbg() which wrote to std::cerr on the spot. Run it with the stderr
+// redirected (eg. to /dev/null), otherwise the terminal is measured.
+
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbg.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+// The dbg() from before the logger.
+template <typename... Args>
+void sync_dbg(Args&&... args)
+{
+  (std::cerr << ... << args);
+  std::cerr << "\n";
+}
+
+template <typename Log>
+double run(size_t threads, size_t lines, Log log)
+{
+  std::atomic_bool go = false;
+  std::atomic_uint64_t nanos = 0;
+
+  std::vector<std::jthread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&go, &nanos, lines, log] {
+      std::string addr = "[::1]:12345";
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+      std::chrono::nanoseconds took{0};
+      for (size_t i = 0; i < lines; ++i) {
+        auto start = steady::now();
+        log(addr, static_cast<int>(i % 25));
+        took += steady::now() - start;
+        // Logging is interleaved with some work in real life.
+        if (i % 8 == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds{100});
+      }
+      nanos += static_cast<uint64_t>(took.count());
+    });
+  }
+
+  go.store(true, std::memory_order_release);
+  workers.clear();
+  return static_cast<double>(nanos.load()) / static_cast<double>(threads * lines);
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    std::vector<size_t> threads;
+    size_t lines;
+
+    po::options_description desc{"Allowed flags for the logging benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("threads,t", po::value<std::vector<size_t>>(&threads)->multitoken()
+       ->default_value({1, 4, 25}, "1 4 25"),
+       "numbers of logging threads to try")
+      ("lines,n", po::value<size_t>(&lines)->default_value(20000),
+       "lines logged by each thread")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags] 2>/dev/null\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    set_log_level(LogLevel::debug);
+    std::cout << "threads\tsync ns/line\tasync ns/line\tdropped\n";
+    for (size_t t : threads) {
+      double sync = run(t, lines, [] (const std::string& addr, int id) {
+        sync_dbg("[game_master] Playing client ", addr, " ie. player ", id,
+                 " has not done anything.");
+      });
+      uint64_t dropped = log_dropped();
+      double async = run(t, lines, [] (const std::string& addr, int id) {
+        dbg("[game_master] Playing client ", addr, " ie. player ", id,
+            " has not done anything.");
+      });
+      std::cout << t << "\t" << sync << "\t" << async << "\t"
+                << log_dropped() - dropped << "\n";
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
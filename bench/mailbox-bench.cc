@@ -0,0 +1,187 @@
+// Contention benchmark for storing players' moves.
+
+// Simulates a number of input-spamming connections (each with its own thread,
+// like client_handler) writing moves into MAX_CLIENTS slots while a single
+// game master gathers all of them once per turn. Compares the old approach
+// (optional move behind a per-client mutex plus playing_clients_mutex) with
+// the lock-free MoveMailbox.
+
+#include <boost/program_options.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mailbox.h"
+#include "messages.h"
+
+namespace po = boost::program_options;
+
+using input_messages::InputMessage;
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr size_t MAX_CLIENTS = 25;
+
+// The way it was done before: a mutex per client and one for the playing map.
+struct LockedSlots {
+  std::mutex playing_mutex;
+  std::array<std::mutex, MAX_CLIENTS> mutices;
+  std::array<std::optional<InputMessage>, MAX_CLIENTS> moves;
+
+  void post(size_t i, const InputMessage& msg)
+  {
+    std::lock_guard<std::mutex> lk{mutices[i]};
+    moves[i] = msg;
+  }
+
+  size_t gather()
+  {
+    size_t n = 0;
+    std::lock_guard<std::mutex> lk{playing_mutex};
+    for (size_t i = 0; i < MAX_CLIENTS; ++i) {
+      std::lock_guard<std::mutex> lk{mutices[i]};
+      n += moves[i].has_value();
+      moves[i] = {};
+    }
+
+    return n;
+  }
+};
+
+struct AtomicSlots {
+  std::array<MoveMailbox, MAX_CLIENTS> mailboxes;
+
+  void post(size_t i, const InputMessage& msg)
+  {
+    mailboxes[i].post(msg);
+  }
+
+  size_t gather()
+  {
+    size_t n = 0;
+    for (MoveMailbox& mailbox : mailboxes)
+      n += mailbox.take().has_value();
+
+    return n;
+  }
+};
+
+struct Result {
+  double secs;
+  uint64_t posts;
+  uint64_t turns;
+  uint64_t gathered;
+  double avg_gather_us;
+  double max_gather_us;
+};
+
+template <typename Slots>
+Result run(size_t connections, std::chrono::milliseconds duration,
+           std::chrono::microseconds turn)
+{
+  Slots slots;
+  std::atomic_bool stop = false;
+  std::atomic_uint64_t posts = 0;
+
+  std::vector<std::jthread> spammers;
+  for (size_t c = 0; c < connections; ++c) {
+    spammers.emplace_back([&slots, &stop, &posts, c] {
+      client_messages::Direction dirs[] = {client_messages::Up{},
+        client_messages::Right{}, client_messages::Down{}, client_messages::Left{}};
+      uint64_t local = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        slots.post(c % MAX_CLIENTS, client_messages::Move{dirs[local % 4]});
+        ++local;
+        // A real handler does a receive syscall per message, give way likewise.
+        std::this_thread::yield();
+      }
+      posts += local;
+    });
+  }
+
+  Result res{0, 0, 0, 0, 0, 0};
+  double total_us = 0;
+  auto begin = steady::now();
+  auto end = begin + duration;
+  while (steady::now() < end) {
+    std::this_thread::sleep_for(turn);
+    auto start = steady::now();
+    res.gathered += slots.gather();
+    double us = std::chrono::duration<double, std::micro>(steady::now() - start).count();
+    total_us += us;
+    res.max_gather_us = std::max(res.max_gather_us, us);
+    ++res.turns;
+  }
+
+  stop = true;
+  res.secs = std::chrono::duration<double>(steady::now() - begin).count();
+  spammers.clear();
+  res.posts = posts;
+  res.avg_gather_us = res.turns ? total_us / static_cast<double>(res.turns) : 0;
+  return res;
+}
+
+void report(const std::string& name, size_t connections, const Result& r)
+{
+  std::cout << name << "\t" << connections << "\t"
+            << static_cast<double>(r.posts) / r.secs << "\t"
+            << r.avg_gather_us << "\t" << r.max_gather_us << "\t"
+            << r.turns << "\n";
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    std::vector<size_t> connections;
+    uint64_t duration_ms;
+    uint64_t turn_us;
+
+    po::options_description desc{"Allowed flags for the mailbox benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("connections,c", po::value<std::vector<size_t>>(&connections)->multitoken()
+       ->default_value({25, 100, 250, 1000}, "25 100 250 1000"),
+       "numbers of spamming connections to try")
+      ("duration,d", po::value<uint64_t>(&duration_ms)->default_value(1000),
+       "duration of a single run in ms")
+      ("turn,t", po::value<uint64_t>(&turn_us)->default_value(1000),
+       "turn duration in microseconds")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    std::chrono::milliseconds duration{duration_ms};
+    std::chrono::microseconds turn{turn_us};
+    std::cout << "impl\tconns\tposts/s\tavg gather us\tmax gather us\tturns\n";
+    for (size_t c : connections) {
+      report("mutex", c, run<LockedSlots>(c, duration, turn));
+      report("mailbox", c, run<AtomicSlots>(c, duration, turn));
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Throughput benchmark of the join queue.
+
+// A number of producers (client handlers) push a burst of Join-like requests
+// while a single consumer (join_handler) pops them. The lock-free MpscQueue
+// is compared with the mutex and condition variable based BlockingQueue the
+// server used before.
+
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "messages.h"
+#include "queue.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+using JoinRequest = std::pair<size_t, server_messages::Player>;
+
+namespace
+{
+
+// https://stackoverflow.com/a/12805690/9058764
+template <typename T>
+class BlockingQueue {
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<T> queue;
+public:
+  void push(T const& value)
+  {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      queue.push_front(value);
+    }
+    cv.notify_one();
+  }
+
+  T pop()
+  {
+    std::unique_lock<std::mutex> lock{mutex};
+    cv.wait(lock, [this] { return !queue.empty(); });
+    T elem{std::move(queue.back())};
+    queue.pop_back();
+    return elem;
+  }
+};
+
+template <typename Queue>
+double run(size_t producers, size_t per_producer)
+{
+  Queue queue;
+  std::atomic_bool go = false;
+
+  std::vector<std::jthread> threads;
+  for (size_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, &go, p, per_producer] {
+      JoinRequest req{p, {"player", "[::1]:12345"}};
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+      for (size_t i = 0; i < per_producer; ++i)
+        queue.push(req);
+    });
+  }
+
+  auto start = steady::now();
+  go.store(true, std::memory_order_release);
+  size_t total = producers * per_producer;
+  size_t checksum = 0;
+  for (size_t i = 0; i < total; ++i)
+    checksum += queue.pop().first;
+
+  double secs = std::chrono::duration<double>(steady::now() - start).count();
+  threads.clear();
+
+  if (checksum != per_producer * producers * (producers - 1) / 2)
+    throw std::logic_error{"Lost some elements on the way!"};
+
+  return static_cast<double>(total) / secs;
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    std::vector<size_t> producers;
+    size_t per_producer;
+
+    po::options_description desc{"Allowed flags for the queue benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("producers,p", po::value<std::vector<size_t>>(&producers)->multitoken()
+       ->default_value({1, 4, 25, 100}, "1 4 25 100"),
+       "numbers of producers to try")
+      ("items,n", po::value<size_t>(&per_producer)->default_value(20000),
+       "items pushed by each producer")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    std::cout << "producers\tblocking/s\tmpsc/s\n";
+    for (size_t p : producers) {
+      double blocking = run<BlockingQueue<JoinRequest>>(p, per_producer);
+      double mpsc = run<MpscQueue<JoinRequest, 256>>(p, per_producer);
+      std::cout << p << "\t" << blocking << "\t" << mpsc << "\n";
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
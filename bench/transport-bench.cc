@@ -0,0 +1,292 @@
+// Loopback benchmark of the server's two transports: asio and io_uring.
+
+// Connects a number of clients to itself over loopback TCP and measures both
+// ways the server talks to them:
+//  - broadcasting a turn of the given size to every client, with a blocking
+//    write per client (asio) or with writes from a registered buffer all
+//    submitted at once (io_uring),
+//  - receiving moves that all the clients keep sending, with a thread per
+//    client reading them off its socket (asio, like client_handler) or with
+//    a multishot receive per client in a single thread (io_uring, like
+//    uring_loop).
+// System calls the server side makes are counted along.
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "marshal.h"
+#include "messages.h"
+#include "readers.h"
+#include "uring.h"
+
+namespace po = boost::program_options;
+
+using boost::asio::ip::tcp;
+using boost::asio::generic::stream_protocol;
+using client_messages::ClientMessage;
+using steady = std::chrono::steady_clock;
+
+namespace
+{
+
+// Both ends of the loopback connections, the server's ones generic like those
+// of RoboticServer.
+struct Connections {
+  boost::asio::io_context io_ctx;
+  std::vector<stream_protocol::socket> server;
+  std::vector<tcp::socket> client;
+
+  explicit Connections(size_t count)
+  {
+    tcp::acceptor acceptor{io_ctx, tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+    for (size_t i = 0; i < count; ++i) {
+      client.emplace_back(io_ctx).connect(acceptor.local_endpoint());
+      acceptor.accept(server.emplace_back(io_ctx));
+      server.back().set_option(tcp::no_delay{true});
+      client.back().set_option(tcp::no_delay{true});
+    }
+  }
+};
+
+// Read every round of the broadcast off all the clients.
+std::jthread drain(Connections& conns, size_t bytes, size_t rounds)
+{
+  return std::jthread{[&conns, bytes, rounds] {
+    std::vector<uint8_t> buff(bytes);
+    for (size_t r = 0; r < rounds; ++r) {
+      for (tcp::socket& sock : conns.client)
+        boost::asio::read(sock, boost::asio::buffer(buff));
+    }
+  }};
+}
+
+// Microseconds per round of broadcasting and system calls made.
+std::pair<double, size_t> broadcast_asio(Connections& conns, const std::vector<uint8_t>& turn,
+                                         size_t rounds)
+{
+  std::jthread reader = drain(conns, turn.size(), rounds);
+  auto start = steady::now();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (stream_protocol::socket& sock : conns.server)
+      boost::asio::write(sock, boost::asio::buffer(turn));
+  }
+  reader.join();
+  double us = std::chrono::duration<double, std::micro>(steady::now() - start).count();
+  return {us / static_cast<double>(rounds), rounds * conns.server.size()};
+}
+
+std::pair<double, size_t> broadcast_uring(Connections& conns, const std::vector<uint8_t>& turn,
+                                          size_t rounds)
+{
+  IoUring ring{64};
+  std::vector<uint8_t> staging = turn;
+  std::array<iovec, 1> buffers{iovec{staging.data(), staging.size()}};
+  ring.register_buffers(buffers);
+
+  std::jthread reader = drain(conns, turn.size(), rounds);
+  size_t calls = 0;
+  std::vector<size_t> written(conns.server.size());
+  auto start = steady::now();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < conns.server.size(); ++i) {
+      written[i] = 0;
+      prep_write_fixed(ring.sqe(), conns.server[i].native_handle(), staging, 0, i);
+    }
+
+    size_t writing = conns.server.size();
+    while (writing > 0) {
+      ring.submit(static_cast<uint32_t>(writing));
+      ++calls;
+      ring.reap([&] (const io_uring_cqe& cqe) {
+        if (cqe.res <= 0)
+          throw std::runtime_error{"Broadcast failed!"};
+
+        size_t i = static_cast<size_t>(cqe.user_data);
+        written[i] += static_cast<size_t>(cqe.res);
+        if (written[i] < staging.size()) {
+          std::span<const uint8_t> rest{staging.data() + written[i], staging.size() - written[i]};
+          prep_write_fixed(ring.sqe(), conns.server[i].native_handle(), rest, 0, i);
+        } else {
+          --writing;
+        }
+      });
+    }
+  }
+  reader.join();
+  double us = std::chrono::duration<double, std::micro>(steady::now() - start).count();
+  return {us / static_cast<double>(rounds), calls};
+}
+
+// Every client sends this many moves.
+std::jthread spam(Connections& conns, size_t moves)
+{
+  return std::jthread{[&conns, moves] {
+    Serialiser ser;
+    ser << ClientMessage{client_messages::Move{client_messages::Up{}}};
+    std::vector<uint8_t> move = ser.to_bytes();
+    for (size_t m = 0; m < moves; ++m) {
+      for (tcp::socket& sock : conns.client)
+        boost::asio::write(sock, boost::asio::buffer(move));
+    }
+  }};
+}
+
+// Microseconds per move received and system calls made.
+std::pair<double, size_t> receive_asio(Connections& conns, size_t moves)
+{
+  auto start = steady::now();
+  std::jthread sender = spam(conns, moves);
+  std::vector<std::jthread> handlers;
+  for (stream_protocol::socket& sock : conns.server) {
+    handlers.emplace_back([&sock, moves] {
+      Deserialiser<ReaderStream> deser{sock};
+      for (size_t m = 0; m < moves; ++m) {
+        ClientMessage msg;
+        deser >> msg;
+      }
+    });
+  }
+  handlers.clear();
+  sender.join();
+  double us = std::chrono::duration<double, std::micro>(steady::now() - start).count();
+  size_t total = moves * conns.server.size();
+  // Each move is read as its variant index and then its direction.
+  return {us / static_cast<double>(total), 2 * total};
+}
+
+std::pair<double, size_t> receive_uring(Connections& conns, size_t moves)
+{
+  IoUring ring{64};
+  ring.provide_buffers(0, 64, 4096);
+  std::vector<std::vector<uint8_t>> input(conns.server.size());
+  for (size_t i = 0; i < conns.server.size(); ++i)
+    prep_recv_multishot(ring.sqe(), conns.server[i].native_handle(), 0, i);
+
+  size_t total = moves * conns.server.size();
+  size_t received = 0;
+  size_t calls = 0;
+  auto start = steady::now();
+  std::jthread sender = spam(conns, moves);
+  while (received < total) {
+    ring.submit(1);
+    ++calls;
+    ring.reap([&] (const io_uring_cqe& cqe) {
+      size_t i = static_cast<size_t>(cqe.user_data);
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        std::span<const uint8_t> bytes = ring.provided(id, static_cast<size_t>(cqe.res));
+        input[i].insert(input[i].end(), bytes.begin(), bytes.end());
+        ring.recycle(id);
+      } else if (cqe.res != -ENOBUFS) {
+        throw std::runtime_error{"Receive failed!"};
+      }
+
+      size_t used = 0;
+      for (;;) {
+        Deserialiser<ReaderMemory> deser{ReaderMemory{input[i].data() + used,
+                                                      input[i].size() - used}};
+        ClientMessage msg;
+        try {
+          deser >> msg;
+        } catch (std::exception& e) {
+          break;
+        }
+        used += deser.readable().position();
+        ++received;
+      }
+      input[i].erase(input[i].begin(), input[i].begin() + static_cast<ptrdiff_t>(used));
+
+      if (!(cqe.flags & IORING_CQE_F_MORE))
+        prep_recv_multishot(ring.sqe(), conns.server[i].native_handle(), 0, i);
+    });
+  }
+  sender.join();
+  double us = std::chrono::duration<double, std::micro>(steady::now() - start).count();
+  return {us / static_cast<double>(total), calls};
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    size_t clients;
+    size_t turn_bytes;
+    size_t rounds;
+    size_t moves;
+
+    po::options_description desc{"Allowed flags for the transport benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("clients,c", po::value<size_t>(&clients)->default_value(25))
+      ("turn-bytes,b", po::value<size_t>(&turn_bytes)->default_value(512),
+       "size of a broadcast turn")
+      ("rounds,r", po::value<size_t>(&rounds)->default_value(2000), "turns broadcast")
+      ("moves,m", po::value<size_t>(&moves)->default_value(2000), "moves sent by every client")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (clients == 0 || turn_bytes == 0)
+      throw std::invalid_argument{"Need some clients and some bytes!"};
+
+    std::vector<uint8_t> turn(turn_bytes, 0x2a);
+    std::cout << "transport\tbroadcast us/turn\tsyscalls/turn\treceive us/move\tsyscalls/move\n";
+    {
+      Connections conns{clients};
+      auto [broadcast_us, broadcast_calls] = broadcast_asio(conns, turn, rounds);
+      auto [receive_us, receive_calls] = receive_asio(conns, moves);
+      std::cout << "asio\t" << broadcast_us << "\t"
+                << static_cast<double>(broadcast_calls) / static_cast<double>(rounds) << "\t"
+                << receive_us << "\t"
+                << static_cast<double>(receive_calls) / static_cast<double>(moves * clients)
+                << "\n";
+    }
+    {
+      Connections conns{clients};
+      auto [broadcast_us, broadcast_calls] = broadcast_uring(conns, turn, rounds);
+      auto [receive_us, receive_calls] = receive_uring(conns, moves);
+      std::cout << "io_uring\t" << broadcast_us << "\t"
+                << static_cast<double>(broadcast_calls) / static_cast<double>(rounds) << "\t"
+                << receive_us << "\t"
+                << static_cast<double>(receive_calls) / static_cast<double>(moves * clients)
+                << "\n";
+    }
+  } catch (UringError& e) {
+    std::cerr << "No io_uring: " << e.what() << "\n";
+    return 1;
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Latency benchmark of the server's two stream transports: loopback TCP and
+// a Unix socket.
+
+// A client sends a move and waits for the turn the server answers with, over
+// and over, both ends speaking the protocol of marshal.h through ReaderStream
+// like robots-client and client_handler do. Round trips are timed one by one
+// and their mean and percentiles reported for either kind of socket.
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/program_options.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "marshal.h"
+#include "messages.h"
+#include "readers.h"
+
+namespace po = boost::program_options;
+
+using boost::asio::ip::tcp;
+using boost::asio::generic::stream_protocol;
+using client_messages::ClientMessage;
+using server_messages::ServerMessage;
+using steady = std::chrono::steady_clock;
+
+namespace local = boost::asio::local;
+
+namespace
+{
+
+// Both ends of a connection.
+struct Connection {
+  boost::asio::io_context io_ctx;
+  stream_protocol::socket server{io_ctx};
+  stream_protocol::socket client{io_ctx};
+};
+
+void connect_tcp(Connection& conn)
+{
+  tcp::acceptor acceptor{conn.io_ctx, tcp::endpoint{boost::asio::ip::address_v4::loopback(), 0}};
+  tcp::socket client{conn.io_ctx};
+  client.connect(acceptor.local_endpoint());
+  client.set_option(tcp::no_delay{true});
+  conn.client = std::move(client);
+  acceptor.accept(conn.server);
+  conn.server.set_option(tcp::no_delay{true});
+}
+
+void connect_unix(Connection& conn, const std::string& path)
+{
+  std::filesystem::remove(path);
+  local::stream_protocol::acceptor acceptor{conn.io_ctx, local::stream_protocol::endpoint{path}};
+  local::stream_protocol::socket client{conn.io_ctx};
+  client.connect(acceptor.local_endpoint());
+  conn.client = std::move(client);
+  acceptor.accept(conn.server);
+  std::filesystem::remove(path);
+}
+
+// A turn in which every player moves.
+std::vector<uint8_t> turn_bytes(uint8_t players)
+{
+  server_messages::Turn turn{1, {}};
+  for (PlayerId id = 0; id < players; ++id)
+    turn.second.emplace_back(std::in_place_type<server_messages::PlayerMoved>, id,
+                             Position{id, id});
+
+  Serialiser ser;
+  ser << ServerMessage{turn};
+  return ser.to_bytes();
+}
+
+// Round trip times in microseconds, sorted.
+std::vector<double> ping_pong(Connection& conn, const std::vector<uint8_t>& turn, size_t rounds)
+{
+  std::jthread server{[&conn, &turn, rounds] {
+    Deserialiser<ReaderStream> deser{conn.server};
+    for (size_t r = 0; r < rounds; ++r) {
+      ClientMessage msg;
+      deser >> msg;
+      boost::asio::write(conn.server, boost::asio::buffer(turn));
+    }
+  }};
+
+  Serialiser ser;
+  ser << ClientMessage{client_messages::Move{client_messages::Up{}}};
+  std::vector<uint8_t> move = ser.to_bytes();
+  Deserialiser<ReaderStream> deser{conn.client};
+  std::vector<double> times;
+  times.reserve(rounds);
+  for (size_t r = 0; r < rounds; ++r) {
+    auto start = steady::now();
+    boost::asio::write(conn.client, boost::asio::buffer(move));
+    ServerMessage msg;
+    deser >> msg;
+    times.push_back(std::chrono::duration<double, std::micro>(steady::now() - start).count());
+  }
+
+  std::sort(times.begin(), times.end());
+  return times;
+}
+
+void report(const std::string& transport, const std::vector<double>& times)
+{
+  auto percentile = [&times] (double p) {
+    return times.at(static_cast<size_t>(p * static_cast<double>(times.size() - 1)));
+  };
+  double mean = std::accumulate(times.begin(), times.end(), 0.0) / static_cast<double>(times.size());
+  std::cout << transport << "\t" << mean << "\t" << percentile(0.5) << "\t"
+            << percentile(0.99) << "\n";
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    uint16_t players;
+    size_t rounds;
+    std::string path;
+
+    po::options_description desc{"Allowed flags for the Unix socket benchmark"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("players-count,c", po::value<uint16_t>(&players)->default_value(25),
+       "players moving in every turn answered")
+      ("rounds,r", po::value<size_t>(&rounds)->default_value(20000), "round trips timed")
+      ("path", po::value<std::string>(&path)->default_value(
+        (std::filesystem::temp_directory_path() / ("unix-bench-" + std::to_string(getpid())))
+        .string()), "where to put the Unix socket")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (players > 255 || rounds == 0)
+      throw std::invalid_argument{"Bad players count or no rounds!"};
+
+    std::vector<uint8_t> turn = turn_bytes(static_cast<uint8_t>(players));
+    std::cout << "transport\tmean us\tp50 us\tp99 us\n";
+    {
+      Connection conn;
+      connect_tcp(conn);
+      report("tcp", ping_pong(conn, turn, rounds));
+    }
+    {
+      Connection conn;
+      connect_unix(conn, path);
+      report("unix", ping_pong(conn, turn, rounds));
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+// Replacement of the global operator new counting allocations.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "alloc-hook.h"
+
+namespace
+{
+
+thread_local uint64_t allocations = 0;
+
+} // namespace anonymous
+
+uint64_t thread_allocations()
+{
+  return allocations;
+}
+
+// The array and nothrow versions end up here as well.
+void* operator new(std::size_t nbytes)
+{
+  ++allocations;
+  if (void* p = std::malloc(nbytes == 0 ? 1 : nbytes))
+    return p;
+
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
@@ -0,0 +1,16 @@
+// Counting of heap allocations, to make sure hot paths do not allocate.
+
+// Linking alloc-hook.cc into a program replaces the global operator new with
+// one that counts the allocations of each thread (a thread local increment on
+// top of malloc, cheap enough to be always on). Reading the counter before and
+// after a piece of code tells whether it allocated.
+
+#ifndef _ALLOC_HOOK_H_
+#define _ALLOC_HOOK_H_
+
+#include <cstdint>
+
+// Allocations made by the calling thread so far.
+uint64_t thread_allocations();
+
+#endif  // _ALLOC_HOOK_H_
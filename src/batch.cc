@@ -0,0 +1,208 @@
+// Implementation of batched stepping of games.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "engine.h"
+#include "mailbox.h"
+#include "messages.h"
+
+namespace
+{
+
+// Observations are read off the engines, events are of no use here.
+class IgnoredEvents : public EventSink {
+public:
+  void bomb_placed(BombId, Position) override {}
+  void bomb_exploded(BombId, std::span<const PlayerId>, std::span<const Position>) override {}
+  void player_moved(PlayerId, Position) override {}
+  void block_placed(Position) override {}
+};
+
+IgnoredEvents ignored;
+
+} // namespace anonymous
+
+GameBatch::GameBatch(const GameRules& rules, uint8_t players_count,
+                     const std::vector<uint32_t>& seeds, size_t threads)
+  : players_count{players_count}
+{
+  for (uint16_t id = 0; id < players_count; ++id)
+    player_ids.insert(static_cast<PlayerId>(id));
+
+  if (rules.size_x == 0 || rules.size_y == 0)
+    throw std::invalid_argument{"The board cannot be empty!"};
+
+  size_t games = seeds.size();
+  engines.reserve(games);
+  for (uint32_t seed : seeds)
+    engines.emplace_back(rules, seed);
+
+  actions.assign(games, Actions(players_count));
+
+  size_t cells = static_cast<size_t>(rules.size_x) * rules.size_y;
+  obs.games = games;
+  obs.players = players_count;
+  obs.bitmap_words = (cells + 63) / 64;
+  // Bombs live for timer turns and a player places at most one per turn.
+  obs.max_bombs = static_cast<size_t>(players_count) * std::max<uint16_t>(rules.timer, 1);
+
+  obs.turns.assign(games, 0);
+  obs.done.assign(games, 0);
+  obs.positions.assign(games * obs.players * 2, 0);
+  obs.scores.assign(games * obs.players, 0);
+  obs.killed.assign(games * obs.players, 0);
+  obs.blocks.assign(games * obs.bitmap_words, 0);
+  obs.bomb_counts.assign(games, 0);
+  obs.bombs.assign(games * obs.max_bombs * 3, 0);
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  threads = std::clamp<size_t>(threads, 1, std::max<size_t>(games, 1));
+  // Workers are told the generation explicitly so none of them misses reset().
+  for (size_t i = 1; i < threads; ++i)
+    workers.emplace_back([this, i] { worker(i, 0); });
+
+  reset();
+}
+
+GameBatch::~GameBatch()
+{
+  stopping = true;
+  generation.fetch_add(1);
+  generation.notify_all();
+}
+
+void GameBatch::reset()
+{
+  // An empty span of moves tells the workers to restart their games.
+  step(std::span<const uint8_t>{});
+}
+
+void GameBatch::step(std::span<const uint8_t> moves)
+{
+  if (!moves.empty() && moves.size() != engines.size() * players_count)
+    throw std::invalid_argument{"Expected one move per player in every game!"};
+
+  pending = moves;
+  remaining.store(workers.size(), std::memory_order_relaxed);
+  // Publishing pending happens through the release part of this increment.
+  generation.fetch_add(1, std::memory_order_acq_rel);
+  generation.notify_all();
+
+  run_share(0, moves);
+
+  for (size_t left = remaining.load(std::memory_order_acquire); left != 0;
+       left = remaining.load(std::memory_order_acquire))
+    remaining.wait(left, std::memory_order_acquire);
+}
+
+void GameBatch::worker(size_t idx, uint32_t seen)
+{
+  for (;;) {
+    generation.wait(seen, std::memory_order_acquire);
+    seen = generation.load(std::memory_order_acquire);
+    if (stopping)
+      return;
+
+    run_share(idx, pending);
+
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      remaining.notify_one();
+  }
+}
+
+void GameBatch::run_share(size_t idx, std::span<const uint8_t> moves)
+{
+  // Contiguous shares so that each thread writes its own part of the buffers.
+  size_t n = threads();
+  size_t begin = engines.size() * idx / n;
+  size_t end = engines.size() * (idx + 1) / n;
+
+  for (size_t g = begin; g < end; ++g)
+    step_game(g, moves);
+}
+
+void GameBatch::step_game(size_t g, std::span<const uint8_t> moves)
+{
+  GameEngine& engine = engines[g];
+
+  if (moves.empty()) {
+    engine.start(player_ids, ignored);
+    observe(g, false);
+    return;
+  }
+
+  Actions& acts = actions[g];
+  for (size_t p = 0; p < players_count; ++p)
+    acts[p] = decode_move(moves[g * players_count + p]);
+
+  engine.step(acts, ignored);
+  if (!engine.finished()) {
+    observe(g, false);
+    return;
+  }
+
+  // Deaths of the final turn are still reported alongside the fresh board.
+  const std::pmr::vector<PlayerId>& last = engine.killed_last_turn();
+  std::vector<PlayerId> killed{last.begin(), last.end()};
+  engine.start(player_ids, ignored);
+  observe(g, true);
+  for (PlayerId id : killed)
+    obs.killed[g * obs.players + id] = 1;
+}
+
+void GameBatch::observe(size_t g, bool done)
+{
+  const GameEngine& engine = engines[g];
+  const GameRules& rules = engine.game_rules();
+
+  obs.turns[g] = engine.turn();
+  obs.done[g] = done;
+
+  uint16_t* positions = &obs.positions[g * obs.players * 2];
+  for (const auto& [id, pos] : engine.player_positions()) {
+    positions[2 * id] = pos.first;
+    positions[2 * id + 1] = pos.second;
+  }
+
+  Score* scores = &obs.scores[g * obs.players];
+  for (const auto& [id, score] : engine.player_scores())
+    scores[id] = score;
+
+  uint8_t* killed = &obs.killed[g * obs.players];
+  std::fill(killed, killed + obs.players, 0);
+  for (PlayerId id : engine.killed_last_turn())
+    killed[id] = 1;
+
+  uint64_t* blocks = &obs.blocks[g * obs.bitmap_words];
+  std::fill(blocks, blocks + obs.bitmap_words, 0);
+  for (auto [x, y] : engine.board_blocks()) {
+    size_t bit = static_cast<size_t>(y) * rules.size_x + x;
+    blocks[bit / 64] |= uint64_t{1} << (bit % 64);
+  }
+
+  uint16_t* bombs = &obs.bombs[g * obs.max_bombs * 3];
+  uint32_t count = 0;
+  for (const auto& [_, bomb] : engine.active_bombs()) {
+    if (count == obs.max_bombs)
+      break;
+
+    const auto& [pos, timer] = bomb;
+    bombs[3 * count] = pos.first;
+    bombs[3 * count + 1] = pos.second;
+    bombs[3 * count + 2] = timer;
+    ++count;
+  }
+
+  obs.bomb_counts[g] = count;
+}
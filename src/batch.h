@@ -0,0 +1,98 @@
+// Many independent games stepped at once, meant for training bots.
+
+// Every game in a batch is a GameEngine of its own (so the rules are exactly
+// the server's) with its own seed. A step applies one action per player in
+// every game, spreading the games over a pool of threads, and then the state
+// of all the games is exported into flat structure-of-arrays buffers so that
+// a learner can consume them without walking any maps or sets.
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "messages.h"
+
+// Observations of all games. Game g's slice of every buffer starts at
+// g times the per-game stride given in the comment.
+struct BatchObservations {
+  size_t games;
+  size_t players;
+  // Words of a single game's block bitmap, bit y * size_x + x is block (x, y).
+  size_t bitmap_words;
+  // Bombs above this count (per game) are not exported.
+  size_t max_bombs;
+
+  std::vector<uint16_t> turns;        // 1
+  std::vector<uint8_t> done;          // 1, set iff the game ended and restarted
+  std::vector<uint16_t> positions;    // players * 2, (x, y)
+  std::vector<Score> scores;          // players, deaths so far
+  std::vector<uint8_t> killed;        // players, died in the last step
+  std::vector<uint64_t> blocks;       // bitmap_words
+  std::vector<uint32_t> bomb_counts;  // 1
+  std::vector<uint16_t> bombs;        // max_bombs * 3, (x, y, timer)
+};
+
+class GameBatch {
+  const uint8_t players_count;
+  std::set<PlayerId> player_ids;
+  std::vector<GameEngine> engines;
+  std::vector<Actions> actions;
+  BatchObservations obs;
+
+  // Pool of workers, the calling thread takes its share of games as well.
+  std::span<const uint8_t> pending;
+  std::atomic_uint32_t generation = 0;
+  std::atomic_size_t remaining = 0;
+  std::atomic_bool stopping = false;
+  // Last so that the workers are joined before anything else goes away.
+  std::vector<std::jthread> workers;
+public:
+  // One game per seed. Threads count includes the caller, zero means as many
+  // as there are cores.
+  GameBatch(const GameRules& rules, uint8_t players_count,
+            const std::vector<uint32_t>& seeds, size_t threads = 0);
+  ~GameBatch();
+
+  GameBatch(const GameBatch&) = delete;
+  GameBatch& operator=(const GameBatch&) = delete;
+
+  // Start all games anew.
+  void reset();
+
+  // Apply actions to all games: games * players move codes (see mailbox.h),
+  // NO_MOVE meaning doing nothing. Games that end are restarted right away.
+  void step(std::span<const uint8_t> moves);
+
+  const BatchObservations& observations() const
+  {
+    return obs;
+  }
+
+  size_t size() const
+  {
+    return engines.size();
+  }
+
+  size_t threads() const
+  {
+    return workers.size() + 1;
+  }
+
+private:
+  void worker(size_t idx, uint32_t seen);
+
+  // Step (or reset if moves are empty) games of the idx-th share.
+  void run_share(size_t idx, std::span<const uint8_t> moves);
+  void step_game(size_t g, std::span<const uint8_t> moves);
+  void observe(size_t g, bool done);
+};
+
+#endif  // _BATCH_H_
@@ -0,0 +1,273 @@
+// Implementation of game checkpoints.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.h"
+#include "marshal.h"
+#include "readers.h"
+#include "dbg.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+fs::path history_path(const fs::path& dir)
+{
+  return dir / "history";
+}
+
+fs::path checkpoint_path(const fs::path& dir)
+{
+  return dir / "checkpoint";
+}
+
+std::string error_text(const std::string& what)
+{
+  return what + ": " + std::strerror(errno);
+}
+
+void write_all(int fd, std::span<const uint8_t> bytes)
+{
+  while (!bytes.empty()) {
+    ssize_t n = ::write(fd, bytes.data(), bytes.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw CheckpointError{error_text("Failed to write a checkpoint")};
+
+    bytes = bytes.subspan(static_cast<size_t>(n));
+  }
+}
+
+std::vector<uint8_t> read_file(const fs::path& path)
+{
+  std::ifstream file{path, std::ios::binary};
+  if (!file)
+    throw CheckpointError{"Cannot read " + path.string() + "!"};
+
+  return std::vector<uint8_t>{std::istreambuf_iterator<char>{file},
+                              std::istreambuf_iterator<char>{}};
+}
+
+} // namespace anonymous
+
+CheckpointWriter::CheckpointWriter(const fs::path& dir, std::vector<uint8_t> hello)
+  : dir{dir}, hello{std::move(hello)}
+{
+  fs::create_directories(dir);
+  history_fd = open(history_path(dir).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (history_fd < 0)
+    throw CheckpointError{error_text("Cannot open the history in " + dir.string())};
+
+  struct stat st;
+  if (fstat(history_fd, &st) == 0)
+    history_size = static_cast<uint64_t>(st.st_size);
+
+  writer = std::jthread{[this] { write_loop(); }};
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  {
+    std::lock_guard<std::mutex> lk{mutex};
+    stop = true;
+  }
+  for_work.notify_one();
+  writer.join();
+  close(history_fd);
+}
+
+void CheckpointWriter::start_game(std::span<const uint8_t> game_started)
+{
+  {
+    std::lock_guard<std::mutex> lk{mutex};
+    pending = true;
+    restart = true;
+    history.assign(game_started.begin(), game_started.end());
+    state.clear();
+  }
+  for_work.notify_one();
+}
+
+void CheckpointWriter::save(std::span<const uint8_t> turns, std::span<const uint8_t> new_state)
+{
+  {
+    std::lock_guard<std::mutex> lk{mutex};
+    pending = true;
+    history.insert(history.end(), turns.begin(), turns.end());
+    state.assign(new_state.begin(), new_state.end());
+  }
+  for_work.notify_one();
+}
+
+void CheckpointWriter::clear()
+{
+  {
+    std::lock_guard<std::mutex> lk{mutex};
+    pending = true;
+    cleared = true;
+    restart = false;
+    history.clear();
+    state.clear();
+  }
+  for_work.notify_one();
+}
+
+void CheckpointWriter::write_loop()
+{
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lk{mutex};
+      for_work.wait(lk, [this] { return pending || stop; });
+      // What is pending is still written, the server may stop mid-game.
+      if (!pending)
+        return;
+
+      std::swap(history, writing_history);
+      std::swap(state, writing_state);
+      history.clear();
+      state.clear();
+      writing_restart = restart;
+      writing_cleared = cleared;
+      pending = restart = cleared = false;
+    }
+
+    try {
+      write();
+      if (!writing_state.empty())
+        ++written;
+    } catch (std::exception& e) {
+      log_warn("[checkpoint] ", e.what());
+      ++failed;
+      // What did not get to the history goes again with the next save,
+      // unless a new game (or none) has come along since.
+      std::lock_guard<std::mutex> lk{mutex};
+      if (!restart && !cleared) {
+        history.insert(history.begin(), writing_history.begin(), writing_history.end());
+        restart = writing_restart;
+        cleared = writing_cleared;
+      }
+    }
+  }
+}
+
+void CheckpointWriter::write()
+{
+  if (writing_restart || writing_cleared) {
+    // The old game's checkpoint must not outlive its history.
+    std::error_code ec;
+    fs::remove(checkpoint_path(dir), ec);
+    if (ftruncate(history_fd, 0) < 0)
+      throw CheckpointError{error_text("Failed to truncate the history")};
+    history_size = 0;
+    history_torn = false;
+    writing_restart = writing_cleared = false;
+  }
+
+  if (history_torn)
+    throw CheckpointError{"The history is torn, no checkpoints until the next game."};
+
+  if (!writing_history.empty()) {
+    try {
+      write_all(history_fd, writing_history);
+      if (fdatasync(history_fd) < 0)
+        throw CheckpointError{error_text("Failed to sync the history")};
+    } catch (CheckpointError&) {
+      // Whatever part of it got in is cut off, to be written again whole.
+      if (ftruncate(history_fd, static_cast<off_t>(history_size)) < 0)
+        history_torn = true;
+      throw;
+    }
+    history_size += writing_history.size();
+    writing_history.clear();
+  }
+
+  if (writing_state.empty())
+    return;
+
+  Serialiser ser;
+  ser.append(std::vector<uint8_t>(std::begin(CHECKPOINT_MAGIC), std::end(CHECKPOINT_MAGIC)));
+  ser << history_size << static_cast<uint32_t>(hello.size());
+  ser.append(hello);
+  ser << static_cast<uint32_t>(writing_state.size());
+  ser.append(writing_state);
+
+  fs::path tmp = checkpoint_path(dir);
+  tmp += ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw CheckpointError{error_text("Failed to create a checkpoint")};
+
+  try {
+    write_all(fd, ser.to_bytes());
+    if (fdatasync(fd) < 0)
+      throw CheckpointError{error_text("Failed to sync a checkpoint")};
+  } catch (CheckpointError&) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+
+  fs::rename(tmp, checkpoint_path(dir));
+  // The rename itself has to reach the disk too.
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+}
+
+std::optional<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+load_checkpoint(const fs::path& dir, const std::vector<uint8_t>& hello)
+{
+  if (!fs::exists(checkpoint_path(dir)))
+    return {};
+
+  std::vector<uint8_t> bytes = read_file(checkpoint_path(dir));
+  if (bytes.size() < sizeof(CHECKPOINT_MAGIC)
+      || std::memcmp(bytes.data(), CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+    throw CheckpointError{"Not a checkpoint: " + checkpoint_path(dir).string()};
+
+  uint64_t offset;
+  std::vector<uint8_t> saved_hello;
+  std::vector<uint8_t> state;
+  try {
+    Deserialiser<ReaderMemory> deser{ReaderMemory{bytes.data(), bytes.size()}};
+    deser.readable().seek(sizeof(CHECKPOINT_MAGIC));
+    uint32_t len;
+    deser >> offset >> len;
+    saved_hello = deser.readable().read(len);
+    deser >> len;
+    state = deser.readable().read(len);
+    deser.no_trailing_bytes();
+  } catch (std::exception& e) {
+    throw CheckpointError{std::string{"Broken checkpoint: "} + e.what()};
+  }
+
+  if (saved_hello != hello)
+    throw CheckpointError{"The checkpoint is of a server with other parameters!"};
+
+  std::vector<uint8_t> history = read_file(history_path(dir));
+  if (history.size() < offset)
+    throw CheckpointError{"The history is shorter than the checkpoint says!"};
+
+  // Turns played after the checkpoint are played again.
+  history.resize(offset);
+  fs::resize_file(history_path(dir), offset);
+  return std::make_pair(std::move(history), std::move(state));
+}
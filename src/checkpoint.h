@@ -0,0 +1,120 @@
+// Checkpoints of the game in progress, for carrying on with it after the
+// server has crashed or been restarted.
+
+// A checkpoint directory holds two files. The history file is GameStarted
+// and then the turns of the current game, appended as the game goes on.
+// The checkpoint file is the state of the game at some turn and how many
+// bytes of the history lead up to it. Turns in the history beyond that
+// offset are dropped when resuming. The checkpoint is written to a temporary
+// file and renamed over the old one, and only after the history it points
+// into has reached the disk, so either of them is always whole. A history
+// write that fails is cut off the file and tried again with the next turns,
+// no checkpoint is written until it succeeds.
+//
+// Checkpoint file layout (numbers in network order, as everything else here):
+//   magic (8 bytes) | history offset (u64) | Hello (u32 length + bytes)
+//   | state (u32 length + bytes)
+//
+// The state itself is whatever the server makes of it. Hello is there so
+// that a server started with other parameters does not resume the game.
+//
+// Writing happens on a thread of its own. game_master only copies what is
+// new into buffers shared with it and never waits for the disk. When the
+// writer lags behind, the newer state replaces the one it has not got to.
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr char CHECKPOINT_MAGIC[8] = {'B', 'O', 'M', 'B', 'C', 'K', 'P', '1'};
+
+class CheckpointError : public std::runtime_error {
+public:
+  CheckpointError() : runtime_error{"Checkpoint error!"} {}
+  CheckpointError(const std::string& msg) : runtime_error{msg} {}
+};
+
+class CheckpointWriter {
+  const std::filesystem::path dir;
+  const std::vector<uint8_t> hello;
+
+  // What has been handed over and not yet taken by the writer.
+  std::mutex mutex;
+  std::condition_variable for_work;
+  bool pending = false;
+  bool restart = false;
+  bool cleared = false;
+  bool stop = false;
+  std::vector<uint8_t> history;
+  std::vector<uint8_t> state;
+
+  // Checkpoints written and those that failed.
+  std::atomic_uint64_t written = 0;
+  std::atomic_uint64_t failed = 0;
+
+  // Writer thread's state.
+  int history_fd = -1;
+  uint64_t history_size = 0;
+  // A failed write could not be cut off, the history is of no use.
+  bool history_torn = false;
+  // Taken from the above, each cleared once done with.
+  bool writing_restart = false;
+  bool writing_cleared = false;
+  std::vector<uint8_t> writing_history;
+  std::vector<uint8_t> writing_state;
+
+  // Last so that it is joined before the rest goes away.
+  std::jthread writer;
+public:
+  // The history already in dir (as left by load_checkpoint) is kept.
+  CheckpointWriter(const std::filesystem::path& dir, std::vector<uint8_t> hello);
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  // A new game: the history starts over with its GameStarted.
+  void start_game(std::span<const uint8_t> game_started);
+
+  // The turns played since the last call and the state after them.
+  void save(std::span<const uint8_t> turns, std::span<const uint8_t> state);
+
+  // Nothing to resume any more, the game is over.
+  void clear();
+
+  uint64_t checkpoints_written() const
+  {
+    return written.load(std::memory_order_relaxed);
+  }
+
+  uint64_t checkpoints_failed() const
+  {
+    return failed.load(std::memory_order_relaxed);
+  }
+
+private:
+  void write_loop();
+  void write();
+};
+
+// History up to the latest checkpoint in dir and the state saved with it, if
+// there is one for a server saying this Hello. The history file is cut to the
+// checkpoint so that a writer carries on from there. Throws CheckpointError
+// if the files are broken.
+std::optional<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+load_checkpoint(const std::filesystem::path& dir, const std::vector<uint8_t>& hello);
+
+#endif  // _CHECKPOINT_H_
@@ -0,0 +1,227 @@
+// Implementation of the logger: per-thread rings and the flusher.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dbg.h"
+
+using log_internal::Record;
+
+namespace
+{
+
+// Records per thread, a burst above this many gets dropped.
+constexpr size_t RING_CAPACITY = 512;
+
+struct Ring {
+  std::unique_ptr<Record[]> records = std::make_unique<Record[]>(RING_CAPACITY);
+  // Written only by the thread owning the ring.
+  alignas(64) std::atomic_uint64_t head = 0;
+  // Written only by the flusher.
+  alignas(64) std::atomic_uint64_t tail = 0;
+  bool in_use = false;
+};
+
+// Rings outlive their threads, they are given back when a thread ends and
+// handed out again to new ones.
+struct State {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::atomic_uint64_t dropped = 0;
+};
+
+class Flusher {
+  std::shared_ptr<State> state = std::make_shared<State>();
+  const int64_t start;
+  std::atomic_bool stopping = false;
+  // Last so that it is joined before anything else goes away.
+  std::jthread thread;
+public:
+  Flusher()
+    : start{std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count()},
+      thread{[this] { run(); }}
+  {}
+
+  ~Flusher()
+  {
+    stopping = true;
+  }
+
+  const std::shared_ptr<State>& shared() const
+  {
+    return state;
+  }
+
+private:
+  // Write out everything pending, oldest first. False if there was nothing.
+  bool flush()
+  {
+    std::vector<std::pair<Ring*, uint64_t>> heads;
+    std::vector<const Record*> batch;
+    {
+      std::lock_guard lk{state->mutex};
+      for (const std::unique_ptr<Ring>& ring : state->rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (uint64_t i = tail; i < head; ++i)
+          batch.push_back(&ring->records[i % RING_CAPACITY]);
+        heads.emplace_back(ring.get(), head);
+      }
+    }
+
+    if (batch.empty())
+      return false;
+
+    std::stable_sort(batch.begin(), batch.end(), [] (const Record* a, const Record* b) {
+      return a->time < b->time;
+    });
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(6);
+    for (const Record* rec : batch) {
+      out << "[" << std::setw(12) << static_cast<double>(rec->time - start) / 1e9 << "] ";
+      switch (rec->level) {
+      case LogLevel::info:
+        out << "info: ";
+        break;
+      case LogLevel::warn:
+        out << "warn: ";
+        break;
+      case LogLevel::error:
+        out << "error: ";
+        break;
+      default:
+        break;
+      }
+      rec->print(out, rec->payload, rec->count);
+      out << "\n";
+    }
+
+    std::cerr << out.str() << std::flush;
+
+    // Rings are never removed so the pointers are still good.
+    for (auto [ring, head] : heads)
+      ring->tail.store(head, std::memory_order_release);
+
+    return true;
+  }
+
+  void run()
+  {
+    auto idle = std::chrono::microseconds{100};
+    for (;;) {
+      bool stop = stopping.load();
+      if (flush()) {
+        idle = std::chrono::microseconds{100};
+      } else if (stop) {
+        return;
+      } else {
+        std::this_thread::sleep_for(idle);
+        idle = std::min<std::chrono::microseconds>(idle * 2, std::chrono::milliseconds{10});
+      }
+    }
+  }
+};
+
+Flusher& flusher()
+{
+  static Flusher f;
+  return f;
+}
+
+struct LocalRing {
+  std::shared_ptr<State> state;
+  Ring* ring = nullptr;
+
+  ~LocalRing()
+  {
+    if (ring) {
+      std::lock_guard lk{state->mutex};
+      ring->in_use = false;
+    }
+  }
+};
+
+thread_local LocalRing local;
+
+Ring& local_ring()
+{
+  if (local.ring) [[likely]]
+    return *local.ring;
+
+  local.state = flusher().shared();
+  std::lock_guard lk{local.state->mutex};
+  for (const std::unique_ptr<Ring>& ring : local.state->rings) {
+    if (!ring->in_use) {
+      local.ring = ring.get();
+      break;
+    }
+  }
+
+  if (!local.ring) {
+    local.state->rings.push_back(std::make_unique<Ring>());
+    local.ring = local.state->rings.back().get();
+  }
+
+  local.ring->in_use = true;
+  return *local.ring;
+}
+
+} // namespace anonymous
+
+LogLevel log_level_from_name(const std::string& name)
+{
+  if (name == "debug")
+    return LogLevel::debug;
+  else if (name == "info")
+    return LogLevel::info;
+  else if (name == "warn")
+    return LogLevel::warn;
+  else if (name == "error")
+    return LogLevel::error;
+  else if (name == "off")
+    return LogLevel::off;
+  else
+    throw std::invalid_argument{"Unknown log level \"" + name + "\"!"};
+}
+
+void set_log_level(LogLevel level)
+{
+  log_internal::level.store(level, std::memory_order_relaxed);
+}
+
+uint64_t log_dropped()
+{
+  return flusher().shared()->dropped.load(std::memory_order_relaxed);
+}
+
+Record* log_internal::reserve()
+{
+  Ring& ring = local_ring();
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+    local.state->dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  return &ring.records[head % RING_CAPACITY];
+}
+
+void log_internal::commit()
+{
+  Ring& ring = *local.ring;
+  ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
@@ -1,9 +1,31 @@
-// Tiny header for a single debugging function both for both client and sever.
+// Logging for both the client and the server, dbg() being the debug level.
+
+// Logging a line never waits for the terminal: the arguments are copied as
+// they are (numbers) or as bytes (strings) into a record in a ring buffer of
+// the calling thread and a background flusher formats them and writes them
+// to the stderr. Rings are single producer single consumer so a log call is
+// a couple of stores, no locks and no allocations (unless an argument is of a
+// type that has to be formatted on the spot, eg. an endpoint). When a ring is
+// full the line is dropped (and counted) rather than stalling the thread.
+//
+// The level is chosen at runtime (see set_log_level), a call below it costs a
+// single relaxed load. Debug builds log everything by default, release ones
+// only info and above.
 
 #ifndef _DBG_H_
 #define _DBG_H_
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 #ifdef NDEBUG
 constexpr bool debug = false;
@@ -11,14 +33,168 @@ constexpr bool debug = false;
 constexpr bool debug = true;
 #endif  // NDEBUG
 
-// Print a debug line to the stderr if in debug mode.
-template <typename... Args>
-void dbg(Args&&... args)
+enum class LogLevel : uint8_t { debug, info, warn, error, off };
+
+// Parse a level name ("debug", "info", "warn", "error" or "off"), throws
+// std::invalid_argument on anything else.
+LogLevel log_level_from_name(const std::string& name);
+
+void set_log_level(LogLevel level);
+
+// Lines dropped because of a full ring.
+uint64_t log_dropped();
+
+namespace log_internal
 {
-  if constexpr (debug) {
-    (std::cerr << ... << args);
-    std::cerr << "\n";
+
+inline std::atomic<LogLevel> level{debug ? LogLevel::debug : LogLevel::info};
+
+constexpr size_t RECORD_SIZE = 256;
+
+// How the arguments are formatted once the flusher gets to them.
+using Printer = void (*)(std::ostream& os, const uint8_t* payload, uint8_t count);
+
+struct Record {
+  int64_t time;
+  Printer print;
+  LogLevel level;
+  // Arguments that fit in the payload, the rest is cut off.
+  uint8_t count;
+  uint16_t size;
+  uint8_t payload[RECORD_SIZE - 24];
+};
+
+static_assert(sizeof(Record) == RECORD_SIZE);
+
+// The calling thread's slot to write a record to, nullptr if its ring is full.
+Record* reserve();
+
+// Hand the reserved record over to the flusher.
+void commit();
+
+// Numbers (and the like) are stored as they are.
+template <typename T>
+struct Plain {
+  static bool write(Record& rec, const T& value)
+  {
+    if (rec.size + sizeof(T) > sizeof(rec.payload))
+      return false;
+
+    std::memcpy(rec.payload + rec.size, &value, sizeof(T));
+    rec.size = static_cast<uint16_t>(rec.size + sizeof(T));
+    return true;
+  }
+
+  static const uint8_t* print(std::ostream& os, const uint8_t* p)
+  {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    os << value;
+    return p + sizeof(T);
+  }
+};
+
+// Strings are copied (and cut if too long), as is anything else once
+// formatted into one.
+struct Text {
+  static bool write_view(Record& rec, std::string_view text)
+  {
+    if (rec.size + sizeof(uint16_t) > sizeof(rec.payload))
+      return false;
+
+    size_t room = sizeof(rec.payload) - rec.size - sizeof(uint16_t);
+    uint16_t len = static_cast<uint16_t>(std::min(text.size(), room));
+    std::memcpy(rec.payload + rec.size, &len, sizeof(len));
+    std::memcpy(rec.payload + rec.size + sizeof(len), text.data(), len);
+    rec.size = static_cast<uint16_t>(rec.size + sizeof(len) + len);
+    return true;
+  }
+
+  template <typename T>
+  static bool write(Record& rec, const T& value)
+  {
+    if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+      return write_view(rec, std::string_view{value});
+    } else {
+      std::ostringstream s;
+      s << value;
+      return write_view(rec, s.str());
+    }
+  }
+
+  static const uint8_t* print(std::ostream& os, const uint8_t* p)
+  {
+    uint16_t len;
+    std::memcpy(&len, p, sizeof(len));
+    os.write(reinterpret_cast<const char*>(p + sizeof(len)), len);
+    return p + sizeof(len) + len;
   }
+};
+
+template <typename T>
+using Codec = std::conditional_t<std::is_arithmetic_v<T> || std::is_enum_v<T>, Plain<T>, Text>;
+
+template <typename... Args>
+void print(std::ostream& os, const uint8_t* payload, uint8_t count)
+{
+  uint8_t i = 0;
+  ((i++ < count ? void(payload = Codec<Args>::print(os, payload)) : void()), ...);
+}
+
+} // namespace log_internal
+
+inline bool log_enabled(LogLevel level)
+{
+  return level >= log_internal::level.load(std::memory_order_relaxed);
+}
+
+template <typename... Args>
+void log_line(LogLevel level, const Args&... args)
+{
+  using namespace log_internal;
+
+  if (!log_enabled(level))
+    return;
+
+  Record* rec = reserve();
+  if (!rec)
+    return;
+
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  rec->time = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  rec->print = &print<std::decay_t<Args>...>;
+  rec->level = level;
+  rec->count = 0;
+  rec->size = 0;
+  bool fits = true;
+  ((fits = fits && Codec<std::decay_t<Args>>::write(*rec, args),
+    rec->count = static_cast<uint8_t>(rec->count + fits)), ...);
+  commit();
+}
+
+// Print a debug line to the stderr if at the debug level.
+template <typename... Args>
+void dbg(const Args&... args)
+{
+  log_line(LogLevel::debug, args...);
+}
+
+template <typename... Args>
+void log_info(const Args&... args)
+{
+  log_line(LogLevel::info, args...);
+}
+
+template <typename... Args>
+void log_warn(const Args&... args)
+{
+  log_line(LogLevel::warn, args...);
+}
+
+template <typename... Args>
+void log_error(const Args&... args)
+{
+  log_line(LogLevel::error, args...);
 }
 
 #endif  // _DBG_H_
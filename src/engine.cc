@@ -0,0 +1,449 @@
+// Implementation of the game rules.
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <set>
+#include <span>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "engine.h"
+#include "marshal.h"
+#include "messages.h"
+#include "dbg.h"
+
+namespace
+{
+
+// Helper for std::visiting mimicking pattern matching, inspired by cppref.
+template<typename> inline constexpr bool always_false_v = false;
+
+// Index of Turn in ServerMessage and of the events in Event, as on the wire.
+constexpr uint8_t TURN_INDEX = 3;
+static_assert(std::is_same_v<std::variant_alternative_t<TURN_INDEX, server_messages::ServerMessage>,
+                             server_messages::Turn>);
+
+constexpr uint8_t BOMB_PLACED = 0;
+constexpr uint8_t BOMB_EXPLODED = 1;
+constexpr uint8_t PLAYER_MOVED = 2;
+constexpr uint8_t BLOCK_PLACED = 3;
+
+template <uint8_t I, typename E>
+constexpr bool event_at = std::is_same_v<std::variant_alternative_t<I, server_messages::Event>, E>;
+
+static_assert(event_at<BOMB_PLACED, server_messages::BombPlaced>
+              && event_at<BOMB_EXPLODED, server_messages::BombExploded>
+              && event_at<PLAYER_MOVED, server_messages::PlayerMoved>
+              && event_at<BLOCK_PLACED, server_messages::BlockPlaced>);
+
+// Index and turn number come before the count of events.
+constexpr size_t EVENTS_OFFSET = sizeof(uint8_t) + sizeof(uint16_t);
+constexpr size_t TURN_HEADER = EVENTS_OFFSET + sizeof(uint32_t);
+
+// Sorted vectors standing in for sets.
+template <typename T>
+void insert_sorted(std::pmr::vector<T>& v, T x)
+{
+  auto it = std::lower_bound(v.begin(), v.end(), x);
+  if (it == v.end() || *it != x)
+    v.insert(it, x);
+}
+
+template <typename T>
+bool contains_sorted(const std::pmr::vector<T>& v, T x)
+{
+  return std::binary_search(v.begin(), v.end(), x);
+}
+
+} // namespace anonymous
+
+void TurnBuilder::bomb_placed(BombId id, Position pos)
+{
+  turn.second.emplace_back(std::in_place_type<server_messages::BombPlaced>, id, pos);
+}
+
+void TurnBuilder::bomb_exploded(BombId id, std::span<const PlayerId> killed,
+                                std::span<const Position> destroyed)
+{
+  turn.second.emplace_back(std::in_place_type<server_messages::BombExploded>, id,
+                           std::set<PlayerId>{killed.begin(), killed.end()},
+                           std::set<Position>{destroyed.begin(), destroyed.end()});
+}
+
+void TurnBuilder::player_moved(PlayerId id, Position pos)
+{
+  turn.second.emplace_back(std::in_place_type<server_messages::PlayerMoved>, id, pos);
+}
+
+void TurnBuilder::block_placed(Position pos)
+{
+  turn.second.emplace_back(std::in_place_type<server_messages::BlockPlaced>, pos);
+}
+
+void TurnEncoder::begin(uint16_t turn)
+{
+  ser.clear();
+  // The count of events is filled in once they are all known.
+  ser << TURN_INDEX << turn << uint32_t{0};
+  events = 0;
+}
+
+size_t TurnEncoder::max_turn_bytes(size_t players)
+{
+  // Placing a bomb is the largest of the moves.
+  size_t placed = sizeof(uint8_t) + sizeof(BombId) + sizeof(Position);
+  size_t exploded = sizeof(uint8_t) + sizeof(BombId) + sizeof(uint32_t) + players * sizeof(PlayerId)
+                    + sizeof(uint32_t) + 4 * sizeof(Position);
+  return TURN_HEADER + players * (placed + exploded);
+}
+
+size_t TurnEncoder::first_turn_bytes(size_t players, size_t blocks)
+{
+  size_t moved = sizeof(uint8_t) + sizeof(PlayerId) + sizeof(Position);
+  size_t placed = sizeof(uint8_t) + sizeof(Position);
+  return TURN_HEADER + players * moved + blocks * placed;
+}
+
+const std::vector<uint8_t>& TurnEncoder::bytes()
+{
+  ser.patch(EVENTS_OFFSET, events);
+  return ser.to_bytes();
+}
+
+void TurnEncoder::bomb_placed(BombId id, Position pos)
+{
+  ser << BOMB_PLACED << id << pos;
+  ++events;
+}
+
+void TurnEncoder::bomb_exploded(BombId id, std::span<const PlayerId> killed,
+                                std::span<const Position> destroyed)
+{
+  ser << BOMB_EXPLODED << id << killed << destroyed;
+  ++events;
+}
+
+void TurnEncoder::player_moved(PlayerId id, Position pos)
+{
+  ser << PLAYER_MOVED << id << pos;
+  ++events;
+}
+
+void TurnEncoder::block_placed(Position pos)
+{
+  ser << BLOCK_PLACED << pos;
+  ++events;
+}
+
+void TurnEncoder::blocks_placed(std::span<const Position> blocks)
+{
+  constexpr size_t BLOCK_BYTES = sizeof(uint8_t) + sizeof(Position);
+  uint8_t* out = ser.extend(blocks.size() * BLOCK_BYTES);
+  for (Position pos : blocks) {
+    uint16_t x = hton<uint16_t>(pos.first);
+    uint16_t y = hton<uint16_t>(pos.second);
+    out[0] = BLOCK_PLACED;
+    std::memcpy(out + 1, &x, sizeof(x));
+    std::memcpy(out + 1 + sizeof(x), &y, sizeof(y));
+    out += BLOCK_BYTES;
+  }
+
+  events += static_cast<uint32_t>(blocks.size());
+}
+
+GameEngine::GameEngine(const GameRules& rules, uint32_t seed)
+  : rules{rules}, rand{seed}, rand_state{static_cast<uint32_t>(seed % std::minstd_rand::modulus)}
+{
+  reset_arena(0);
+}
+
+void GameEngine::end()
+{
+  reset_arena(0);
+}
+
+size_t GameEngine::max_blocks(size_t players) const
+{
+  // Blocks are placed at most one per player a turn and there are only so
+  // many cells, but the initial ones are all drawn before repeats go.
+  size_t cells = size_t{rules.size_x} * rules.size_y;
+  return std::max<size_t>(rules.initial_blocks,
+                          std::min(cells, rules.initial_blocks + players * rules.game_len));
+}
+
+size_t GameEngine::arena_bytes(size_t players) const
+{
+  // A map node is the value and three pointers and a colour, rounded up. Each
+  // allocation may lose some bytes to alignment too.
+  constexpr size_t NODE = 4 * sizeof(void*);
+  constexpr size_t SLACK = alignof(std::max_align_t);
+  size_t bytes = players * (2 * NODE + sizeof(std::pair<PlayerId, Position>)
+                            + sizeof(std::pair<PlayerId, Score>) + 2 * SLACK);
+  bytes += players * (rules.timer + 1u) * sizeof(std::pair<BombId, server_messages::Bomb>);
+  bytes += max_blocks(players) * sizeof(Position);
+  bytes += 2 * players * sizeof(PlayerId) + (4 * players + 4) * sizeof(Position);
+  return bytes + 8 * SLACK;
+}
+
+void GameEngine::reset_arena(size_t bytes)
+{
+  // The state goes first so that nothing points into the arena any more.
+  game.reset();
+  if (!arena || bytes > arena_size) {
+    arena.reset();
+    arena_buffer = std::make_unique_for_overwrite<std::byte[]>(bytes);
+    arena_size = bytes;
+    arena = std::make_unique<std::pmr::monotonic_buffer_resource>(arena_buffer.get(), bytes);
+  } else {
+    arena->release();
+  }
+
+  game.emplace(arena.get());
+}
+
+uint32_t GameEngine::draw()
+{
+  rand_state = static_cast<uint32_t>(rand());
+  return rand_state;
+}
+
+Position GameEngine::random_position()
+{
+  // Note: braced initialisation guarantees x is drawn before y.
+  return Position{static_cast<uint16_t>(draw() % rules.size_x),
+                  static_cast<uint16_t>(draw() % rules.size_y)};
+}
+
+bool GameEngine::has_block(Position pos) const
+{
+  return contains_sorted(game->blocks, pos);
+}
+
+server_messages::Turn GameEngine::start(const std::set<PlayerId>& players)
+{
+  TurnBuilder builder{0};
+  start(players, builder);
+  return builder.take();
+}
+
+server_messages::Turn GameEngine::step(const Actions& actions)
+{
+  TurnBuilder builder{static_cast<uint16_t>(turn_number + 1)};
+  step(actions, builder);
+  return builder.take();
+}
+
+void GameEngine::start(const std::set<PlayerId>& players, EventSink& sink)
+{
+  dbg("[engine] Starting the game, cleaning all data and composing turn 0.");
+  turn_number = 0;
+  next_bomb_id = 0;
+  prepare(players.size());
+
+  for (PlayerId id : players) {
+    game->scores[id] = 0;
+    dbg("[engine] Placing player ", static_cast<int>(id), " on the board.");
+    Position pos = random_position();
+    game->positions[id] = pos;
+    sink.player_moved(id, pos);
+  }
+
+  // The whole board in one go: draw all the positions (in the same order as
+  // one by one, so a seed gives the same board), sort the repeated ones out
+  // and hand them to the sink together.
+  dbg("[engine] Placing ", rules.initial_blocks, " blocks on the board.");
+  game->blocks.resize(rules.initial_blocks);
+  for (Position& pos : game->blocks)
+    pos = random_position();
+
+  std::sort(game->blocks.begin(), game->blocks.end());
+  game->blocks.erase(std::unique(game->blocks.begin(), game->blocks.end()), game->blocks.end());
+  sink.blocks_placed(game->blocks);
+}
+
+void GameEngine::prepare(size_t players)
+{
+  reset_arena(arena_bytes(players));
+
+  // Whatever a turn can need, so that turns do not have to grow these (as
+  // the arena never reuses what they would leave behind).
+  game->killed_this_turn.reserve(players);
+  game->killed_by_bomb.reserve(players);
+  game->destroyed_by_bomb.reserve(4);
+  game->destroyed_this_turn.reserve(4 * players);
+  game->bombs.reserve(players * (rules.timer + 1u));
+  game->blocks.reserve(max_blocks(players));
+}
+
+void GameEngine::save(Serialiser& ser) const
+{
+  // The same as serialising a Snapshot.
+  ser << turn_number << next_bomb_id << rand_state << game->positions << game->scores
+      << game->bombs << game->blocks;
+}
+
+void GameEngine::restore(const Snapshot& snapshot)
+{
+  const auto& [turn, next_bomb, state, positions, scores, bombs, blocks] = snapshot;
+  dbg("[engine] Restoring the game at turn ", turn, ".");
+  prepare(positions.size());
+  turn_number = turn;
+  next_bomb_id = next_bomb;
+  rand_state = state;
+  rand.seed(state);
+  game->positions.insert(positions.begin(), positions.end());
+  game->scores.insert(scores.begin(), scores.end());
+  game->bombs.assign(bombs.begin(), bombs.end());
+  game->blocks.assign(blocks.begin(), blocks.end());
+}
+
+void GameEngine::step(const Actions& actions, EventSink& sink)
+{
+  ++turn_number;
+  game->killed_this_turn.clear();
+  game->destroyed_this_turn.clear();
+  do_bombing(sink);
+
+  for (const auto& [id, _] : game->positions) {
+    // The dead do not move.
+    if (contains_sorted(game->killed_this_turn, id) || id >= actions.size() ||
+        !actions[id].has_value())
+      continue;
+
+    do_action(sink, id, actions[id].value());
+  }
+
+  for (PlayerId id : game->killed_this_turn) {
+    dbg("[engine] Player ", static_cast<int>(id), " died, respawning them");
+    Position pos = random_position();
+    game->positions[id] = pos;
+    sink.player_moved(id, pos);
+  }
+
+  // Deaths are counted and destroyed blocks vanish only once the turn is over.
+  for (PlayerId id : game->killed_this_turn)
+    ++game->scores.at(id);
+
+  if (!game->destroyed_this_turn.empty())
+    std::erase_if(game->blocks, [this] (Position pos) {
+      return contains_sorted(game->destroyed_this_turn, pos);
+    });
+}
+
+void GameEngine::do_bombing(EventSink& sink)
+{
+  bool exploded = false;
+  for (auto& [bombid, bomb] : game->bombs) {
+    auto& [bomb_pos, bomb_timer] = bomb;
+    --bomb_timer;
+    if (bomb_timer != 0)
+      continue;
+
+    game->killed_by_bomb.clear();
+    game->destroyed_by_bomb.clear();
+
+    client_messages::Direction dirs[] = {client_messages::Up{},
+      client_messages::Down{}, client_messages::Left{}, client_messages::Right{}};
+
+    // Go in all directions and do the explosive bit of action.
+    for (client_messages::Direction d : dirs)
+      explode_in_radius(bomb_pos, d);
+
+    sink.bomb_exploded(bombid, game->killed_by_bomb, game->destroyed_by_bomb);
+    exploded = true;
+  }
+
+  // An exploded bomb is gone, its id will not be given out again though.
+  if (exploded)
+    std::erase_if(game->bombs, [] (const auto& b) { return b.second.second == 0; });
+}
+
+void GameEngine::do_action(EventSink& sink, PlayerId id,
+                           const input_messages::InputMessage& action)
+{
+  using namespace client_messages;
+
+  // Pattern match the player's action.
+  std::visit([this, &sink, id] <typename Cm> (const Cm& cm) {
+      if constexpr (std::same_as<Cm, PlaceBomb>) {
+        dbg("[engine] Player ", static_cast<int>(id), " has placed a bomb.");
+        BombId bombid = next_bomb_id++;
+        server_messages::Bomb bomb{game->positions.at(id), rules.timer};
+        game->bombs.emplace_back(bombid, bomb);
+        sink.bomb_placed(bombid, bomb.first);
+      } else if constexpr (std::same_as<Cm, PlaceBlock>) {
+        dbg("[engine] Player ", static_cast<int>(id), " has placed a block.");
+        Position pos = game->positions.at(id);
+        insert_sorted(game->blocks, pos);
+        sink.block_placed(pos);
+      } else if constexpr (std::same_as<Cm, Move>) {
+        dbg("[engine] Player ", static_cast<int>(id), " wants to move.");
+        Position pos = game->positions.at(id);
+        Position new_pos = do_move(pos, cm);
+        if (!has_block(new_pos) && pos != new_pos) {
+          game->positions.at(id) = new_pos;
+          sink.player_moved(id, new_pos);
+        }
+      } else {
+        static_assert(always_false_v<Cm>, "Non-exhaustive pattern matching!");
+      }
+    }, action);
+}
+
+void GameEngine::kill_on_position(Position pos)
+{
+  // Not super effective but MAX_CLIENTS is 25 so this is theoretically O(1).
+  for (const auto& [id, pl_pos] : game->positions)
+    if (pl_pos == pos) {
+      insert_sorted(game->killed_by_bomb, id);
+      insert_sorted(game->killed_this_turn, id);
+    }
+}
+
+void GameEngine::explode_in_radius(Position pos, client_messages::Direction dir)
+{
+  // Note: `<= radius` as the bomb position itself is also affected.
+  for (uint16_t i = 0; i <= rules.radius; ++i) {
+    Position next = do_move(pos, dir);
+    kill_on_position(pos);
+
+    if (has_block(pos)) {
+      insert_sorted(game->destroyed_by_bomb, pos);
+      insert_sorted(game->destroyed_this_turn, pos);
+      return;
+    }
+
+    if (next == pos)
+      return;
+
+    pos = next;
+  }
+}
+
+Position GameEngine::do_move(Position pos, client_messages::Direction dir) const
+{
+  using namespace client_messages;
+
+  return std::visit([this, pos] <typename D> (D) {
+      auto [x, y] = pos;
+      if constexpr (std::same_as<D, Up>) {
+        return (y + 1 < rules.size_y) ? Position{x, y + 1} : pos;
+      } else if constexpr (std::same_as<D, Down>) {
+        return (y > 0) ? Position{x, y - 1} : pos;
+      } else if constexpr (std::same_as<D, Left>) {
+        return (x > 0) ? Position{x - 1, y} : pos;
+      } else if constexpr (std::same_as<D, Right>) {
+        return (x + 1 < rules.size_x) ? Position{x + 1, y} : pos;
+      } else {
+        static_assert(always_false_v<D>, "Non-exhaustive pattern matching!");
+      }
+    }, dir);
+}
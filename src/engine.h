@@ -0,0 +1,282 @@
+// Rules of the game, free of any networking and threading.
+
+// The engine holds the state of a single game and advances it one turn at a
+// time given the moves the players have chosen, producing the events of that
+// turn exactly as the server sends them. The server drives it from its
+// game_master thread, but it is just as usable on its own (see robots-sim).
+//
+// Events are handed to an EventSink as they happen. All the state is kept in
+// flat containers which are cleared rather than thrown away, so once they have
+// grown to the size of the game a turn does not allocate (given a sink which
+// does not allocate either, like TurnEncoder).
+//
+// The state of a game lives in an arena (a std::pmr monotonic buffer) sized
+// for the whole game when it starts. Nothing is given back to it during the
+// game, the arena is released in one go when the game ends, so games do not
+// fragment the heap of a server running for days.
+
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include "marshal.h"
+#include "messages.h"
+
+// Parameters the rules depend on: those announced in Hello and initial blocks.
+struct GameRules {
+  uint16_t size_x;
+  uint16_t size_y;
+  uint16_t game_len;
+  uint16_t radius;
+  uint16_t timer;
+  uint16_t initial_blocks;
+};
+
+// Moves chosen by players for a single turn, indexed by their ids. A missing
+// entry (or an empty one) means the player does nothing this turn.
+using Actions = std::vector<std::optional<input_messages::InputMessage>>;
+
+// Receives events of a turn, in order, as the engine produces them.
+class EventSink {
+public:
+  virtual ~EventSink() = default;
+
+  virtual void bomb_placed(BombId id, Position pos) = 0;
+  // Both killed and destroyed are sorted and free of repetitions.
+  virtual void bomb_exploded(BombId id, std::span<const PlayerId> killed,
+                             std::span<const Position> destroyed) = 0;
+  virtual void player_moved(PlayerId id, Position pos) = 0;
+  virtual void block_placed(Position pos) = 0;
+
+  // All the blocks of the initial board at once, sorted and free of
+  // repetitions. Sinks can do better than one block_placed after another.
+  virtual void blocks_placed(std::span<const Position> blocks)
+  {
+    for (Position pos : blocks)
+      block_placed(pos);
+  }
+};
+
+// Collects the events into a server_messages::Turn.
+class TurnBuilder : public EventSink {
+  server_messages::Turn turn;
+public:
+  TurnBuilder(uint16_t turn_number) : turn{turn_number, {}} {}
+
+  server_messages::Turn take()
+  {
+    return std::move(turn);
+  }
+
+  void bomb_placed(BombId id, Position pos) override;
+  void bomb_exploded(BombId id, std::span<const PlayerId> killed,
+                     std::span<const Position> destroyed) override;
+  void player_moved(PlayerId id, Position pos) override;
+  void block_placed(Position pos) override;
+};
+
+// Encodes the events as they come straight into the bytes of a Turn server
+// message, exactly as serialising a server_messages::Turn would. The buffer
+// is reused from turn to turn so the same bytes can go to the history and to
+// the clients without ever building the events themselves.
+class TurnEncoder : public EventSink {
+  Serialiser ser;
+  uint32_t events = 0;
+public:
+  // Start encoding a turn, forgetting the previous one but keeping the memory.
+  void begin(uint16_t turn);
+
+  void reserve(size_t nbytes)
+  {
+    ser.reserve(nbytes);
+  }
+
+  // Upper bound on the size of a Turn in a game of that many players: each of
+  // them can place one thing and have at most one bomb explode per turn, an
+  // explosion destroys at most four blocks.
+  static size_t max_turn_bytes(size_t players);
+
+  // Size of the first turn, which places the players and the initial blocks.
+  static size_t first_turn_bytes(size_t players, size_t blocks);
+
+  size_t size() const
+  {
+    return events;
+  }
+
+  // The whole message, valid until the next begin().
+  const std::vector<uint8_t>& bytes();
+
+  void bomb_placed(BombId id, Position pos) override;
+  void bomb_exploded(BombId id, std::span<const PlayerId> killed,
+                     std::span<const Position> destroyed) override;
+  void player_moved(PlayerId id, Position pos) override;
+  void block_placed(Position pos) override;
+  void blocks_placed(std::span<const Position> blocks) override;
+};
+
+class GameEngine {
+  const GameRules rules;
+
+  // Randomness is not reseeded between games, one generator per engine. Its
+  // state is its last number (it is a linear congruential one), kept here
+  // for saving the game.
+  std::minstd_rand rand;
+  uint32_t rand_state;
+
+  uint16_t turn_number = 0;
+
+  // Bomb ids are never reused within a game.
+  BombId next_bomb_id = 0;
+
+  // All that is allocated during a game.
+  struct State {
+    std::pmr::map<PlayerId, Position> positions;
+    std::pmr::map<PlayerId, Score> scores;
+    // Ordered by id, as ids only grow new bombs go to the back.
+    std::pmr::vector<std::pair<BombId, server_messages::Bomb>> bombs;
+    // Sorted and free of repetitions, these are sets in all but name.
+    std::pmr::vector<Position> blocks;
+    std::pmr::vector<PlayerId> killed_this_turn;
+    std::pmr::vector<Position> destroyed_this_turn;
+
+    // Scratch space of a single explosion.
+    std::pmr::vector<PlayerId> killed_by_bomb;
+    std::pmr::vector<Position> destroyed_by_bomb;
+
+    explicit State(std::pmr::memory_resource* arena)
+      : positions{arena}, scores{arena}, bombs{arena}, blocks{arena}, killed_this_turn{arena},
+        destroyed_this_turn{arena}, killed_by_bomb{arena}, destroyed_by_bomb{arena} {}
+  };
+
+  // The arena's memory is kept from game to game and only grows when a game
+  // needs more, both are behind pointers so that engines can be moved.
+  std::unique_ptr<std::byte[]> arena_buffer;
+  size_t arena_size = 0;
+  std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+  std::optional<State> game;
+public:
+  // All that is needed to carry on with a game in progress: the turn, next
+  // bomb id, state of the generator, positions, scores, bombs and blocks. A
+  // tuple so that it is serialisable as it is.
+  using Snapshot = std::tuple<uint16_t, BombId, uint32_t, std::map<PlayerId, Position>,
+                              std::map<PlayerId, Score>,
+                              std::vector<std::pair<BombId, server_messages::Bomb>>,
+                              std::vector<Position>>;
+
+  GameEngine(const GameRules& rules, uint32_t seed);
+
+  // Start a new game for the given players. Turn 0 which places the players
+  // and the initial blocks goes to the sink.
+  void start(const std::set<PlayerId>& players, EventSink& sink);
+
+  // Advance the game by one turn: explode bombs, apply the players' moves and
+  // respawn those who died.
+  void step(const Actions& actions, EventSink& sink);
+
+  // The above with the turn collected into a server_messages::Turn.
+  server_messages::Turn start(const std::set<PlayerId>& players);
+  server_messages::Turn step(const Actions& actions);
+
+  // Serialise the Snapshot of the game in progress, without building it (so
+  // that the game's containers are not copied, nor anything allocated).
+  void save(Serialiser& ser) const;
+
+  // Carry on with a saved game as if it had been played here, up to and
+  // including the snapshot's turn.
+  void restore(const Snapshot& snapshot);
+
+  // Drop the state of the game, releasing the arena. Starting the next game
+  // does it as well, this is for giving the memory back as soon as possible.
+  void end();
+
+  // Bytes of the arena a game of that many players takes.
+  size_t arena_bytes(size_t players) const;
+
+  // Whether the last turn of the game has been played.
+  bool finished() const
+  {
+    return turn_number + 1 >= rules.game_len;
+  }
+
+  uint16_t turn() const
+  {
+    return turn_number;
+  }
+
+  const GameRules& game_rules() const
+  {
+    return rules;
+  }
+
+  const std::pmr::map<PlayerId, Position>& player_positions() const
+  {
+    return game->positions;
+  }
+
+  const std::pmr::vector<std::pair<BombId, server_messages::Bomb>>& active_bombs() const
+  {
+    return game->bombs;
+  }
+
+  // Sorted.
+  const std::pmr::vector<Position>& board_blocks() const
+  {
+    return game->blocks;
+  }
+
+  bool has_block(Position pos) const;
+
+  const std::pmr::map<PlayerId, Score>& player_scores() const
+  {
+    return game->scores;
+  }
+
+  // Sorted.
+  const std::pmr::vector<PlayerId>& killed_last_turn() const
+  {
+    return game->killed_this_turn;
+  }
+
+private:
+  // Empty state in an arena of at least that many bytes.
+  void reset_arena(size_t bytes);
+
+  // Empty state for a game of that many players, with room for all of it.
+  void prepare(size_t players);
+
+  uint32_t draw();
+
+  // Most blocks there can be during a game.
+  size_t max_blocks(size_t players) const;
+
+  Position random_position();
+
+  // This function does all bombing related stuff (deaths, destruction, timers).
+  void do_bombing(EventSink& sink);
+
+  // Apply a single player's move.
+  void do_action(EventSink& sink, PlayerId id, const input_messages::InputMessage& action);
+
+  // Simulate an explosion at given position spreading in chosen direction.
+  void explode_in_radius(Position pos, client_messages::Direction dir);
+
+  // Find players at position pos and kill them.
+  void kill_on_position(Position pos);
+
+  // Simulating a move in direction dir from position pos.
+  Position do_move(Position pos, client_messages::Direction dir) const;
+};
+
+#endif  // _ENGINE_H_
@@ -0,0 +1,208 @@
+// Implementation of the shared memory feed.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "feed.h"
+
+namespace
+{
+
+constexpr size_t FEED_ALIGN = 8;
+constexpr size_t FEED_MIN_CAPACITY = 4096;
+
+std::string error_text(const std::string& what, const std::string& name)
+{
+  return what + " " + name + ": " + std::strerror(errno);
+}
+
+// Bytes a record of a message of this size takes in the ring.
+uint64_t record_size(size_t size)
+{
+  return (sizeof(uint32_t) + size + FEED_ALIGN - 1) & ~uint64_t{FEED_ALIGN - 1};
+}
+
+} // namespace anonymous
+
+FeedWriter::FeedWriter(const std::string& name, size_t capacity, const std::vector<uint8_t>& hello)
+  : name{name}
+{
+  if (hello.size() > FEED_HELLO_MAX)
+    throw FeedError{"Hello too big for the feed!"};
+
+  capacity = std::bit_ceil(std::max(capacity, FEED_MIN_CAPACITY));
+  size = sizeof(FeedHeader) + capacity;
+
+  // Whatever a previous server left behind goes, its readers keep their copy.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    throw FeedError{error_text("Failed to create the feed", name)};
+
+  if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+    FeedError e{error_text("Failed to size the feed", name)};
+    close(fd);
+    shm_unlink(name.c_str());
+    throw e;
+  }
+
+  memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    FeedError e{error_text("Failed to map the feed", name)};
+    shm_unlink(name.c_str());
+    throw e;
+  }
+
+  header = new (memory) FeedHeader{};
+  header->capacity = capacity;
+  header->hello_size = static_cast<uint32_t>(hello.size());
+  std::copy(hello.begin(), hello.end(), header->hello);
+  ring = static_cast<uint8_t*>(memory) + sizeof(FeedHeader);
+  mask = capacity - 1;
+
+  // Readers check the magic first, so it comes once all the rest is there.
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header->magic, FEED_MAGIC, sizeof(FEED_MAGIC));
+}
+
+FeedWriter::~FeedWriter()
+{
+  munmap(memory, size);
+  shm_unlink(name.c_str());
+}
+
+bool FeedWriter::publish(std::span<const uint8_t> message)
+{
+  uint64_t len = record_size(message.size());
+  if (len > (mask + 1) / 2) {
+    ++too_big;
+    return false;
+  }
+
+  uint64_t offset = head & mask;
+  uint64_t start = head;
+  if (offset + len > mask + 1)
+    start += mask + 1 - offset;
+  uint64_t end = start + len;
+
+  // Readers must learn that what they might be reading goes before it goes.
+  if (end > mask + 1)
+    header->tail.store(end - (mask + 1), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (start != head) {
+    uint32_t wrap = FEED_WRAP;
+    std::memcpy(ring + offset, &wrap, sizeof(wrap));
+  }
+  uint32_t size = static_cast<uint32_t>(message.size());
+  std::memcpy(ring + (start & mask), &size, sizeof(size));
+  std::memcpy(ring + (start & mask) + sizeof(size), message.data(), message.size());
+
+  head = end;
+  header->head.store(end, std::memory_order_release);
+  return true;
+}
+
+FeedReader::FeedReader(const std::string& name)
+{
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    throw FeedError{error_text("Failed to open the feed", name)};
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(FeedHeader)) {
+    close(fd);
+    throw FeedError{"Not a feed: " + name};
+  }
+
+  size = static_cast<size_t>(st.st_size);
+  memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    throw FeedError{error_text("Failed to map the feed", name)};
+
+  header = static_cast<const FeedHeader*>(memory);
+  if (std::memcmp(header->magic, FEED_MAGIC, sizeof(FEED_MAGIC)) != 0
+      || !std::has_single_bit(header->capacity)
+      || sizeof(FeedHeader) + header->capacity != size
+      || header->hello_size > FEED_HELLO_MAX) {
+    munmap(memory, size);
+    throw FeedError{"Not a feed: " + name};
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  ring = static_cast<const uint8_t*>(memory) + sizeof(FeedHeader);
+  mask = header->capacity - 1;
+  pos = header->head.load(std::memory_order_acquire);
+  next_pos = pos;
+}
+
+FeedReader::~FeedReader()
+{
+  munmap(memory, size);
+}
+
+bool FeedReader::overrun(uint64_t at) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return header->tail.load(std::memory_order_relaxed) > at;
+}
+
+void FeedReader::skip()
+{
+  ++lost;
+  pos = header->head.load(std::memory_order_acquire);
+  next_pos = pos;
+}
+
+std::optional<std::span<const uint8_t>> FeedReader::peek()
+{
+  for (;;) {
+    if (pos == header->head.load(std::memory_order_acquire))
+      return std::nullopt;
+
+    uint32_t size;
+    std::memcpy(&size, ring + (pos & mask), sizeof(size));
+    // The size itself might have been overwritten while read.
+    if (overrun(pos)) {
+      skip();
+      continue;
+    }
+
+    if (size == FEED_WRAP) {
+      pos += mask + 1 - (pos & mask);
+      continue;
+    }
+    if (record_size(size) > (mask + 1) / 2)
+      throw FeedError{"Broken feed!"};
+
+    next_pos = pos + record_size(size);
+    return std::span<const uint8_t>{ring + (pos & mask) + sizeof(size), size};
+  }
+}
+
+bool FeedReader::done()
+{
+  if (overrun(pos)) {
+    skip();
+    return false;
+  }
+
+  pos = next_pos;
+  return true;
+}
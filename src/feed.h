@@ -0,0 +1,124 @@
+// Feed of the games in POSIX shared memory for local consumers.
+
+// The server publishes every GameStarted, Turn and GameEnded, serialised just
+// as they go over the wire, into a ring of bytes in a shared memory object.
+// Any number of local processes (analytics, recorders, overlays) map it and
+// read at their own pace without taking a client's place or being written
+// to: the server never looks at them, so publishing costs the same whoever
+// reads.
+//
+// Layout: a FeedHeader (with the server's Hello) and then the ring. Records
+// are a u32 size (in the host's order, it is all local) and the message,
+// aligned to 8 bytes. A record never wraps around: one that does not fit
+// before the end of the ring is preceded by a FEED_WRAP marker and starts at
+// the beginning. Positions count bytes ever written, head is the end of the
+// last whole record and tail says everything before it may be overwritten.
+// The writer moves tail before writing and head after, so a reader who has
+// read in place finds out whether it was overrun meanwhile by looking at
+// tail again (like a seqlock), and then skips to the newest record.
+
+#ifndef _FEED_H_
+#define _FEED_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr char FEED_MAGIC[8] = {'B', 'O', 'M', 'B', 'F', 'E', 'E', 'D'};
+constexpr size_t FEED_HELLO_MAX = 512;
+constexpr uint32_t FEED_WRAP = ~uint32_t{0};
+
+class FeedError : public std::runtime_error {
+public:
+  FeedError() : runtime_error{"Feed error!"} {}
+  FeedError(const std::string& msg) : runtime_error{msg} {}
+};
+
+// Shared with other processes, so the atomics must not need a lock.
+static_assert(std::atomic_uint64_t::is_always_lock_free);
+
+struct FeedHeader {
+  char magic[8];
+  uint64_t capacity;
+  uint32_t hello_size;
+  uint8_t hello[FEED_HELLO_MAX];
+  alignas(64) std::atomic_uint64_t head;
+  alignas(64) std::atomic_uint64_t tail;
+};
+
+// The server's side, creating the shared memory object (replacing one left
+// behind) and removing it when gone.
+class FeedWriter {
+  std::string name;
+  void* memory = nullptr;
+  size_t size = 0;
+  FeedHeader* header;
+  uint8_t* ring;
+  uint64_t mask;
+  uint64_t head = 0;
+  uint64_t too_big = 0;
+public:
+  // The capacity is rounded up to a power of two.
+  FeedWriter(const std::string& name, size_t capacity, const std::vector<uint8_t>& hello);
+  ~FeedWriter();
+
+  FeedWriter(const FeedWriter&) = delete;
+  FeedWriter& operator=(const FeedWriter&) = delete;
+
+  // Copy the message into the ring, unless it is bigger than half of it.
+  // Never blocks nor allocates.
+  bool publish(std::span<const uint8_t> message);
+
+  // Messages too big to publish.
+  uint64_t skipped() const
+  {
+    return too_big;
+  }
+};
+
+// A consumer's side, reading from the newest record on.
+class FeedReader {
+  void* memory = nullptr;
+  size_t size = 0;
+  const FeedHeader* header;
+  const uint8_t* ring;
+  uint64_t mask;
+  uint64_t pos;
+  uint64_t next_pos;
+  uint64_t lost = 0;
+
+  bool overrun(uint64_t at) const;
+  void skip();
+public:
+  explicit FeedReader(const std::string& name);
+  ~FeedReader();
+
+  FeedReader(const FeedReader&) = delete;
+  FeedReader& operator=(const FeedReader&) = delete;
+
+  std::span<const uint8_t> hello() const
+  {
+    return {header->hello, header->hello_size};
+  }
+
+  // The next message read in place, if there is one yet. What is made of it
+  // may only be trusted once done says it has not been overwritten since.
+  std::optional<std::span<const uint8_t>> peek();
+
+  // Move past the peeked message. False if it has been overrun meanwhile,
+  // the reader then goes on from the newest record.
+  bool done();
+
+  // Times the reader has been overrun and skipped ahead.
+  uint64_t overruns() const
+  {
+    return lost;
+  }
+};
+
+#endif  // _FEED_H_
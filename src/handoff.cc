@@ -0,0 +1,137 @@
+// Implementation of passing connections between processes.
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "handoff.h"
+
+namespace
+{
+
+std::string error_text(const std::string& what, int err)
+{
+  return what + ": " + std::strerror(err);
+}
+
+// Room for the control message of a single descriptor.
+union FdControl {
+  cmsghdr header;
+  char buff[CMSG_SPACE(sizeof(int))];
+};
+
+void write_all(int sock, const void* data, size_t len)
+{
+  const char* p = static_cast<const char*>(data);
+  while (len > 0) {
+    ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw HandoffError{error_text("Failed to send a handoff", errno)};
+
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+}
+
+} // namespace anonymous
+
+void send_handoff(int sock, HandoffOp op, int fd)
+{
+  uint8_t byte = static_cast<uint8_t>(op);
+  iovec iov{&byte, 1};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  FdControl control{};
+  if (fd >= 0) {
+    msg.msg_control = control.buff;
+    msg.msg_controllen = sizeof(control.buff);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  for (;;) {
+    ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (n == 1)
+      return;
+    if (n < 0 && errno != EINTR)
+      throw HandoffError{error_text("Failed to send a handoff", errno)};
+  }
+}
+
+std::pair<HandoffOp, int> receive_handoff(int sock)
+{
+  uint8_t byte;
+  iovec iov{&byte, 1};
+  FdControl control{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buff;
+  msg.msg_controllen = sizeof(control.buff);
+
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    throw HandoffError{error_text("Failed to receive a handoff", errno)};
+  if (n == 0)
+    throw HandoffError{"The other side has gone!"};
+
+  int fd = -1;
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  HandoffOp op = static_cast<HandoffOp>(byte);
+  if (op != HandoffOp::load && op != HandoffOp::client) {
+    if (fd >= 0)
+      close(fd);
+    throw HandoffError{"Unknown handoff!"};
+  }
+
+  return {op, fd};
+}
+
+void send_load(int sock, WorkerLoad load)
+{
+  uint32_t net[2] = {htonl(load.first), htonl(load.second)};
+  write_all(sock, net, sizeof(net));
+}
+
+WorkerLoad receive_load(int sock)
+{
+  uint32_t net[2];
+  char* p = reinterpret_cast<char*>(net);
+  size_t left = sizeof(net);
+  while (left > 0) {
+    ssize_t n = recv(sock, p, left, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw HandoffError{error_text("Failed to receive the load", errno)};
+    if (n == 0)
+      throw HandoffError{"The other side has gone!"};
+
+    p += n;
+    left -= static_cast<size_t>(n);
+  }
+
+  return {ntohl(net[0]), ntohl(net[1])};
+}
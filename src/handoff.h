@@ -0,0 +1,46 @@
+// Handing accepted connections over from robots-router to robots-server.
+
+// A server started with --handoff-socket listens for the router on that Unix
+// socket. The router asks over it, one byte each, about the server's load or
+// hands it a client connection, the descriptor going along the byte
+// (SCM_RIGHTS). The server answers both with its load, so the router always
+// knows whom to pick next. Once handed over, the connection is the server's
+// alone: the client's bytes never pass through the router.
+
+#ifndef _HANDOFF_H_
+#define _HANDOFF_H_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Load of a server: free places and how many more clients its lobby wants
+// for a game (none while a game is on).
+using WorkerLoad = std::pair<uint32_t, uint32_t>;
+
+class HandoffError : public std::runtime_error {
+public:
+  HandoffError() : runtime_error{"Handoff error!"} {}
+  HandoffError(const std::string& msg) : runtime_error{msg} {}
+};
+
+enum class HandoffOp : uint8_t {
+  // What is the load?
+  load = 'l',
+  // Here is a client (with the descriptor).
+  client = 'c',
+};
+
+// Send the op over the Unix socket sock, with the descriptor fd if not -1.
+void send_handoff(int sock, HandoffOp op, int fd = -1);
+
+// The next op and the descriptor that came with it (-1 if none), throws
+// HandoffError once the other side is gone.
+std::pair<HandoffOp, int> receive_handoff(int sock);
+
+// The answer to either op.
+void send_load(int sock, WorkerLoad load);
+WorkerLoad receive_load(int sock);
+
+#endif  // _HANDOFF_H_
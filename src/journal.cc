@@ -0,0 +1,189 @@
+// Implementation of the game journal.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "journal.h"
+#include "marshal.h"
+#include "readers.h"
+#include "dbg.h"
+
+namespace fs = std::filesystem;
+
+JournalWriter::JournalWriter(const fs::path& dir, std::vector<uint8_t> hello)
+  : dir{dir}, hello{std::move(hello)}
+{
+  fs::create_directories(dir);
+  writer = std::jthread{[this] { write_loop(); }};
+}
+
+JournalWriter::~JournalWriter()
+{
+  records.push(Record{Kind::stop, 0, {}});
+}
+
+void JournalWriter::record(Kind kind, uint16_t turn, std::span<const uint8_t> bytes)
+{
+  std::vector<uint8_t> copy = spare.try_pop().value_or(std::vector<uint8_t>{});
+  copy.assign(bytes.begin(), bytes.end());
+  if (!records.try_push(Record{kind, turn, std::move(copy)}))
+    dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void JournalWriter::write_loop()
+{
+  for (;;) {
+    std::optional<Record> rec = records.try_pop();
+    if (!rec.has_value()) {
+      // Nothing to do for now, a good moment to hand the data to the kernel.
+      journal.flush();
+      index.flush();
+      rec = records.pop();
+    }
+
+    if (rec->kind == Kind::stop)
+      return;
+
+    write(rec.value());
+    rec->bytes.clear();
+    spare.try_push(std::move(rec->bytes));
+  }
+}
+
+void JournalWriter::open_game()
+{
+  journal.close();
+  index.close();
+
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  auto secs = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+  fs::path path = dir / ("game-" + std::to_string(secs) + "-" +
+                         std::to_string(games++) + ".journal");
+  dbg("[journal] Writing the game to ", path);
+
+  journal.open(path, std::ios::binary | std::ios::trunc);
+  index.open(journal_index_path(path), std::ios::binary | std::ios::trunc);
+  offset = 0;
+  next_turn = 0;
+  broken = !journal || !index;
+
+  if (broken) {
+    log_error("Failed to open the journal ", path.string());
+    return;
+  }
+
+  Serialiser ser;
+  ser << JOURNAL_INDEX_STRIDE;
+  index.write(JOURNAL_INDEX_MAGIC, sizeof(JOURNAL_INDEX_MAGIC));
+  index.write(reinterpret_cast<const char*>(ser.to_bytes().data()),
+              static_cast<std::streamsize>(ser.size()));
+}
+
+void JournalWriter::write(const Record& rec)
+{
+  auto append = [this] (const std::vector<uint8_t>& bytes) {
+    journal.write(reinterpret_cast<const char*>(bytes.data()),
+                  static_cast<std::streamsize>(bytes.size()));
+    offset += bytes.size();
+  };
+
+  switch (rec.kind) {
+  case Kind::game_started:
+    open_game();
+    if (!broken) {
+      append(hello);
+      append(rec.bytes);
+    }
+    break;
+  case Kind::turn:
+    if (broken || !journal.is_open())
+      break;
+
+    // Turns come in order unless some got dropped, a journal with a hole in
+    // it would be useless so we stop right there.
+    if (rec.turn != next_turn) {
+      log_error("Journal lost turn ", next_turn, ", giving up on this game.");
+      broken = true;
+      break;
+    }
+
+    if (rec.turn % JOURNAL_INDEX_STRIDE == 0) {
+      Serialiser ser;
+      ser << offset;
+      index.write(reinterpret_cast<const char*>(ser.to_bytes().data()),
+                  static_cast<std::streamsize>(ser.size()));
+    }
+
+    append(rec.bytes);
+    ++next_turn;
+    break;
+  case Kind::game_ended:
+    if (!broken && journal.is_open())
+      append(rec.bytes);
+
+    journal.close();
+    index.close();
+    break;
+  case Kind::stop:
+    break;
+  }
+
+  if (!journal && journal.is_open()) {
+    log_error("Failed to write to the journal, giving up on this game.");
+    broken = true;
+  }
+}
+
+std::optional<JournalIndex> JournalIndex::load(const fs::path& journal)
+{
+  std::ifstream in{journal_index_path(journal), std::ios::binary};
+  if (!in)
+    return {};
+
+  std::vector<uint8_t> bytes{std::istreambuf_iterator<char>{in},
+                             std::istreambuf_iterator<char>{}};
+  if (bytes.size() < sizeof(JOURNAL_INDEX_MAGIC) ||
+      std::memcmp(bytes.data(), JOURNAL_INDEX_MAGIC, sizeof(JOURNAL_INDEX_MAGIC)) != 0)
+    return {};
+
+  JournalIndex idx;
+  Deserialiser<ReaderMemory> deser{ReaderMemory{bytes.data() + sizeof(JOURNAL_INDEX_MAGIC),
+                                                bytes.size() - sizeof(JOURNAL_INDEX_MAGIC)}};
+  try {
+    deser >> idx.stride;
+    // A partially written entry at the end (the server died) is ignored.
+    while (deser.avalaible() >= sizeof(uint64_t)) {
+      uint64_t off;
+      deser >> off;
+      idx.offsets.push_back(off);
+    }
+  } catch (UnmarshallingError& e) {
+    return {};
+  }
+
+  if (idx.stride == 0)
+    return {};
+
+  return idx;
+}
+
+std::optional<std::pair<uint16_t, uint64_t>> JournalIndex::seek(uint16_t turn) const
+{
+  if (offsets.empty())
+    return {};
+
+  size_t entry = std::min<size_t>(turn / stride, offsets.size() - 1);
+  return std::pair{static_cast<uint16_t>(entry * stride), offsets[entry]};
+}
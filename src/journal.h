@@ -0,0 +1,120 @@
+// Journal of played games: their messages saved on disk as they happen.
+
+// Each game gets its own append-only journal file holding Hello, GameStarted,
+// all the Turns and GameEnded exactly as they went over the wire, so that
+// such a file is itself a valid stream of server messages. Next to it lives a
+// sparse index: the offset of every JOURNAL_INDEX_STRIDE-th turn, which makes
+// seeking to any turn a matter of one lookup and at most a stride of skips.
+//
+// Index file layout (numbers in network order, as everything else here):
+//   magic (8 bytes) | stride (u32) | offset of turn 0 (u64) | of turn stride...
+//
+// The writing itself happens on a separate thread, the game loop only hands
+// the bytes over through a lock-free queue and never waits for the disk. The
+// buffers it copies them into come back through another queue once written,
+// so that after the first few turns the game loop does not allocate.
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "queue.h"
+
+constexpr char JOURNAL_INDEX_MAGIC[8] = {'B', 'O', 'M', 'B', 'I', 'D', 'X', '1'};
+constexpr uint32_t JOURNAL_INDEX_STRIDE = 64;
+constexpr size_t JOURNAL_QUEUE_CAPACITY = 4096;
+
+// Path of the index belonging to a journal.
+inline std::filesystem::path journal_index_path(const std::filesystem::path& journal)
+{
+  std::filesystem::path idx = journal;
+  return idx += ".idx";
+}
+
+class JournalWriter {
+public:
+  enum class Kind : uint8_t { game_started, turn, game_ended, stop };
+
+private:
+  struct Record {
+    Kind kind;
+    uint16_t turn;
+    std::vector<uint8_t> bytes;
+  };
+
+  const std::filesystem::path dir;
+  const std::vector<uint8_t> hello;
+  MpscQueue<Record, JOURNAL_QUEUE_CAPACITY> records;
+  // Buffers of written records, for record to reuse.
+  MpscQueue<std::vector<uint8_t>, JOURNAL_QUEUE_CAPACITY> spare;
+
+  // Records that did not fit in the queue, such a game's journal is cut short.
+  std::atomic_uint64_t dropped = 0;
+
+  // Writer thread's state.
+  std::ofstream journal;
+  std::ofstream index;
+  uint64_t offset = 0;
+  uint16_t next_turn = 0;
+  uint64_t games = 0;
+  bool broken = false;
+
+  // Last so that it is joined before the queue goes away.
+  std::jthread writer;
+public:
+  // Hello does not change for the whole life of the server so it is given once.
+  JournalWriter(const std::filesystem::path& dir, std::vector<uint8_t> hello);
+  ~JournalWriter();
+
+  JournalWriter(const JournalWriter&) = delete;
+  JournalWriter& operator=(const JournalWriter&) = delete;
+
+  // Hand a copy of the serialised message over to the writer. Never blocks:
+  // if the writer lags so far behind that the queue is full the record is
+  // dropped. Only ever called by one thread (which takes the spare buffers).
+  void record(Kind kind, uint16_t turn, std::span<const uint8_t> bytes);
+
+  uint64_t dropped_records() const
+  {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  void write_loop();
+  void write(const Record& rec);
+  void open_game();
+};
+
+// Read side of the journal index.
+class JournalIndex {
+  uint32_t stride = JOURNAL_INDEX_STRIDE;
+  std::vector<uint64_t> offsets;
+public:
+  // Empty optional if there's no (valid) index for this journal.
+  static std::optional<JournalIndex> load(const std::filesystem::path& journal);
+
+  // Closest indexed turn not after the given one and its offset.
+  std::optional<std::pair<uint16_t, uint64_t>> seek(uint16_t turn) const;
+
+  uint32_t index_stride() const
+  {
+    return stride;
+  }
+
+  size_t size() const
+  {
+    return offsets.size();
+  }
+};
+
+#endif  // _JOURNAL_H_
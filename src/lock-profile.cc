@@ -0,0 +1,156 @@
+// Implementation of lock profiling.
+
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "lock-profile.h"
+
+namespace
+{
+
+// Bucket of the first wait is up to 128ns.
+constexpr size_t FIRST_BUCKET_LOG = 7;
+
+double seconds(uint64_t ns)
+{
+  return static_cast<double>(ns) / 1e9;
+}
+
+double micros(uint64_t ns)
+{
+  return static_cast<double>(ns) / 1e3;
+}
+
+// Signal handlers may do little more than write, so the one for exiting only
+// tells the reporting thread which signal came.
+int exit_pipe[2] = {-1, -1};
+
+void on_exit_signal(int sig)
+{
+  uint8_t byte = static_cast<uint8_t>(sig);
+  [[maybe_unused]] ssize_t n = write(exit_pipe[1], &byte, 1);
+}
+
+} // namespace anonymous
+
+void LockStats::waited(std::chrono::nanoseconds wait)
+{
+  uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(wait.count(), 0));
+  size_t bucket = ns <= 1 ? 0 : std::bit_width(ns - 1);
+  bucket = bucket <= FIRST_BUCKET_LOG ? 0 : bucket - FIRST_BUCKET_LOG;
+  bucket = std::min(bucket, LOCK_WAIT_BUCKETS);
+
+  contended.fetch_add(1, std::memory_order_relaxed);
+  waits[bucket].fetch_add(1, std::memory_order_relaxed);
+  wait_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void LockStats::held(std::chrono::nanoseconds hold)
+{
+  uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(hold.count(), 0));
+  uint64_t max = max_hold_ns.load(std::memory_order_relaxed);
+  while (ns > max && !max_hold_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+    ;
+}
+
+LockStats& LockProfiler::named(const std::string& name)
+{
+  for (LockStats& lock : stats) {
+    if (lock.name == name)
+      return lock;
+  }
+
+  return stats.emplace_back(name);
+}
+
+std::string LockProfiler::render() const
+{
+  std::ostringstream out;
+  out << "# HELP bomberperson_lock_acquisitions_total Times a lock was taken.\n"
+      << "# TYPE bomberperson_lock_acquisitions_total counter\n";
+  for (const LockStats& lock : stats)
+    out << "bomberperson_lock_acquisitions_total{lock=\"" << lock.name << "\"} "
+        << lock.acquisitions.load(std::memory_order_relaxed) << "\n";
+
+  out << "# HELP bomberperson_lock_contended_total Times a lock was found taken.\n"
+      << "# TYPE bomberperson_lock_contended_total counter\n";
+  for (const LockStats& lock : stats)
+    out << "bomberperson_lock_contended_total{lock=\"" << lock.name << "\"} "
+        << lock.contended.load(std::memory_order_relaxed) << "\n";
+
+  out << "# HELP bomberperson_lock_wait_seconds Time spent waiting for a taken lock.\n"
+      << "# TYPE bomberperson_lock_wait_seconds histogram\n";
+  for (const LockStats& lock : stats) {
+    const std::string labels = "lock=\"" + lock.name + "\"";
+    uint64_t count = 0;
+    for (size_t b = 0; b < LOCK_WAIT_BUCKETS; ++b) {
+      count += lock.waits[b].load(std::memory_order_relaxed);
+      double le = seconds(uint64_t{1} << (b + FIRST_BUCKET_LOG));
+      out << "bomberperson_lock_wait_seconds_bucket{" << labels << ",le=\"" << le << "\"} "
+          << count << "\n";
+    }
+    count += lock.waits[LOCK_WAIT_BUCKETS].load(std::memory_order_relaxed);
+    out << "bomberperson_lock_wait_seconds_bucket{" << labels << ",le=\"+Inf\"} "
+        << count << "\n"
+        << "bomberperson_lock_wait_seconds_sum{" << labels << "} "
+        << seconds(lock.wait_ns.load(std::memory_order_relaxed)) << "\n"
+        << "bomberperson_lock_wait_seconds_count{" << labels << "} " << count << "\n";
+  }
+
+  out << "# HELP bomberperson_lock_max_hold_seconds Longest a lock was held exclusively.\n"
+      << "# TYPE bomberperson_lock_max_hold_seconds gauge\n";
+  for (const LockStats& lock : stats)
+    out << "bomberperson_lock_max_hold_seconds{lock=\"" << lock.name << "\"} "
+        << seconds(lock.max_hold_ns.load(std::memory_order_relaxed)) << "\n";
+
+  return out.str();
+}
+
+std::string LockProfiler::report() const
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  for (const LockStats& lock : stats) {
+    uint64_t contended = lock.contended.load(std::memory_order_relaxed);
+    uint64_t wait_ns = lock.wait_ns.load(std::memory_order_relaxed);
+    out << "[locks] " << lock.name
+        << ": " << lock.acquisitions.load(std::memory_order_relaxed) << " taken, "
+        << contended << " contended, "
+        << micros(contended == 0 ? 0 : wait_ns / contended) << "us mean wait, "
+        << micros(wait_ns) << "us waited, "
+        << micros(lock.max_hold_ns.load(std::memory_order_relaxed)) << "us max hold\n";
+  }
+
+  return out.str();
+}
+
+void LockProfiler::report_on_exit() const
+{
+  if (pipe(exit_pipe) < 0)
+    return;
+
+  std::thread{[this] {
+      uint8_t sig = 0;
+      while (read(exit_pipe[0], &sig, 1) < 0)
+        ;
+      std::cerr << report() << std::flush;
+      // Dying of the signal as if it had never been caught.
+      std::signal(sig, SIG_DFL);
+      std::raise(sig);
+    }}.detach();
+
+  std::signal(SIGINT, on_exit_signal);
+  std::signal(SIGTERM, on_exit_signal);
+}
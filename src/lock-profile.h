@@ -0,0 +1,159 @@
+// Profiling of the server's locks: who waits for them and for how long.
+
+// ProfiledLock wraps a std::mutex or std::shared_mutex and is used just like
+// one. Until profiling is turned on for it (by attaching LockStats) it only
+// checks a null pointer on top of the mutex itself. Once attached, every
+// acquisition is counted and tried without waiting first. Only when that
+// fails is the wait timed, into power of two buckets of nanoseconds.
+// Exclusive holds are timed as well, keeping the longest one. Shared holds
+// overlap each other and are not timed. Several locks may share their stats,
+// eg. the clients' mutices, one per client, are profiled as "clients".
+//
+// LockProfiler keeps the stats of all named locks and renders them in the
+// Prometheus text format (for the metrics socket) or as a short report.
+
+#ifndef _LOCK_PROFILE_H_
+#define _LOCK_PROFILE_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+// Waits up to 2^(LOCK_WAIT_BUCKETS + 6)ns, from 128ns to about a second.
+constexpr size_t LOCK_WAIT_BUCKETS = 24;
+
+struct LockStats {
+  std::string name;
+  std::atomic_uint64_t acquisitions = 0;
+  std::atomic_uint64_t contended = 0;
+  // Bucket b counts waits up to 2^(b + 7)ns, the last one anything longer.
+  std::array<std::atomic_uint64_t, LOCK_WAIT_BUCKETS + 1> waits{};
+  std::atomic_uint64_t wait_ns = 0;
+  std::atomic_uint64_t max_hold_ns = 0;
+
+  explicit LockStats(const std::string& name) : name{name} {}
+
+  void acquired()
+  {
+    acquisitions.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // After the lock was found taken.
+  void waited(std::chrono::nanoseconds wait);
+  void held(std::chrono::nanoseconds hold);
+};
+
+class LockProfiler {
+  // Stable addresses for the locks pointing at them.
+  std::deque<LockStats> stats;
+public:
+  // Stats of the lock with this name, made when first asked for.
+  LockStats& named(const std::string& name);
+
+  // All locks in the Prometheus text format.
+  std::string render() const;
+
+  // A line a lock, for people.
+  std::string report() const;
+
+  // Print report() to stderr once the process gets SIGINT or SIGTERM,
+  // whichever thread they come to, then let the signal do what it would have
+  // done anyway. The profiler has to live on.
+  void report_on_exit() const;
+};
+
+template <typename Mutex>
+class ProfiledLock {
+  using clock = std::chrono::steady_clock;
+
+  Mutex mutex;
+  LockStats* stats = nullptr;
+  // Written by the exclusive owner only.
+  clock::time_point locked_at;
+
+  // Wait for the mutex, timing the wait if it is held by somebody.
+  template <typename Try, typename Lock>
+  void acquire(Try try_lock, Lock lock)
+  {
+    stats->acquired();
+    if ((mutex.*try_lock)())
+      return;
+
+    clock::time_point start = clock::now();
+    (mutex.*lock)();
+    stats->waited(clock::now() - start);
+  }
+public:
+  // Start profiling, before anybody uses the lock.
+  void profile(LockStats& lock_stats)
+  {
+    stats = &lock_stats;
+  }
+
+  void lock()
+  {
+    if (!stats) [[likely]] {
+      mutex.lock();
+      return;
+    }
+
+    acquire(&Mutex::try_lock, &Mutex::lock);
+    locked_at = clock::now();
+  }
+
+  bool try_lock()
+  {
+    if (!mutex.try_lock())
+      return false;
+
+    if (stats) {
+      stats->acquired();
+      locked_at = clock::now();
+    }
+    return true;
+  }
+
+  void unlock()
+  {
+    if (stats)
+      stats->held(clock::now() - locked_at);
+    mutex.unlock();
+  }
+
+  void lock_shared() requires std::same_as<Mutex, std::shared_mutex>
+  {
+    if (!stats) [[likely]] {
+      mutex.lock_shared();
+      return;
+    }
+
+    acquire(&Mutex::try_lock_shared, &Mutex::lock_shared);
+  }
+
+  bool try_lock_shared() requires std::same_as<Mutex, std::shared_mutex>
+  {
+    if (!mutex.try_lock_shared())
+      return false;
+
+    if (stats)
+      stats->acquired();
+    return true;
+  }
+
+  void unlock_shared() requires std::same_as<Mutex, std::shared_mutex>
+  {
+    mutex.unlock_shared();
+  }
+};
+
+using ProfiledMutex = ProfiledLock<std::mutex>;
+using ProfiledSharedMutex = ProfiledLock<std::shared_mutex>;
+
+#endif  // _LOCK_PROFILE_H_
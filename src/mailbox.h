@@ -0,0 +1,86 @@
+// Lock-free single-slot mailbox for players' moves.
+
+// Each connected client gets one of those. The client's handler thread posts
+// every move it receives and the game master takes whatever is there at the
+// turn boundary, thus only the latest move within a turn counts (as it always
+// did). A move is encoded as one byte so that the slot can be a plain atomic:
+// no mutex is taken on either side.
+
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <variant>
+
+#include "messages.h"
+
+// Codes of the moves. Zero means there is nothing in the mailbox, moves are
+// numbered after the order of alternatives in InputMessage and Direction.
+constexpr uint8_t NO_MOVE = 0;
+constexpr uint8_t PLACE_BOMB_CODE = 1;
+constexpr uint8_t PLACE_BLOCK_CODE = 2;
+constexpr uint8_t MOVE_CODE = 3;
+constexpr uint8_t MOVE_CODES_END = MOVE_CODE + std::variant_size_v<client_messages::Direction>;
+
+inline uint8_t encode_move(const input_messages::InputMessage& msg)
+{
+  using namespace client_messages;
+  if (const Move* dir = std::get_if<Move>(&msg))
+    return static_cast<uint8_t>(MOVE_CODE + dir->index());
+
+  return std::holds_alternative<PlaceBomb>(msg) ? PLACE_BOMB_CODE : PLACE_BLOCK_CODE;
+}
+
+inline std::optional<input_messages::InputMessage> decode_move(uint8_t code)
+{
+  using namespace client_messages;
+  static constexpr Direction dirs[] = {Up{}, Right{}, Down{}, Left{}};
+
+  if (code == PLACE_BOMB_CODE)
+    return PlaceBomb{};
+  else if (code == PLACE_BLOCK_CODE)
+    return PlaceBlock{};
+  else if (code >= MOVE_CODE && code < MOVE_CODES_END)
+    return Move{dirs[code - MOVE_CODE]};
+  else
+    return {};
+}
+
+// Aligned to a cache line so that clients spamming their own mailboxes do not
+// invalidate each other's lines.
+class alignas(64) MoveMailbox {
+  std::atomic<uint8_t> slot = NO_MOVE;
+public:
+  // Latest write wins, the previous unread move (if any) is simply dropped.
+  // Returns whether there was one, ie. this move collapsed it. Repeating the
+  // unread move stores nothing, keeping the line shared with the game master.
+  bool post(const input_messages::InputMessage& msg)
+  {
+    uint8_t code = encode_move(msg);
+    uint8_t unread = slot.load(std::memory_order_relaxed);
+    if (unread != code)
+      slot.store(code, std::memory_order_release);
+
+    return unread != NO_MOVE;
+  }
+
+  // Swap the mailbox out, leaving it empty.
+  std::optional<input_messages::InputMessage> take()
+  {
+    // Cheap check first so that idle players do not cost us a locked rmw.
+    if (slot.load(std::memory_order_relaxed) == NO_MOVE)
+      return {};
+
+    return decode_move(slot.exchange(NO_MOVE, std::memory_order_acquire));
+  }
+
+  void clear()
+  {
+    slot.store(NO_MOVE, std::memory_order_relaxed);
+  }
+};
+
+#endif  // _MAILBOX_H_
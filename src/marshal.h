@@ -25,6 +25,7 @@
 #include <tuple>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 // This concept describes a class from which the deserialiser can read bytes.
 // It should be possible to extract a chosen number of those depending on what
@@ -109,6 +110,41 @@ public:
     return out;
   }
 
+  // Forget the output but keep the memory for what comes next.
+  void clear()
+  {
+    out.clear();
+  }
+
+  void reserve(size_t nbytes)
+  {
+    out.reserve(nbytes);
+  }
+
+  // Make room for n more bytes to be written directly, for hot loops where
+  // going through the operator byte by byte would cost too much.
+  uint8_t* extend(size_t n)
+  {
+    size_t at = out.size();
+    out.resize(at + n);
+    return out.data() + at;
+  }
+
+  // Append bytes serialised elsewhere.
+  void append(const std::vector<uint8_t>& bytes)
+  {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+  }
+
+  // Overwrite a number serialised earlier at the given offset, eg. a length
+  // not known at the time.
+  template <std::integral T>
+  void patch(size_t at, const T& item)
+  {
+    T net = hton<T>(item);
+    std::memcpy(out.data() + at, &net, sizeof(T));
+  }
+
   // Get current output and clean it.
   std::vector<uint8_t> drain_bytes()
   {
@@ -0,0 +1,214 @@
+// Implementation of the metrics.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "metrics.h"
+#include "dbg.h"
+
+using boost::asio::local::stream_protocol;
+
+namespace
+{
+
+// Cells of a histogram: the buckets, +Inf and the sum in nanoseconds.
+constexpr size_t HISTOGRAM_CELLS = METRICS_BUCKETS + 2;
+
+} // namespace anonymous
+
+Metrics::Id Metrics::add_family(Family&& family, size_t cells)
+{
+  std::lock_guard lk{state->mutex};
+  if (state->frozen)
+    throw std::logic_error{"Metric " + family.name + " registered too late!"};
+
+  family.first = state->cells;
+  state->cells += cells;
+  families.push_back(std::move(family));
+  return families.back().first;
+}
+
+Metrics::Id Metrics::counter(const std::string& name, const std::string& help,
+                             size_t labels, const std::string& label_name)
+{
+  return add_family(Family{name, help, Type::counter, 0, labels, label_name, {}}, labels);
+}
+
+void Metrics::counter(const std::string& name, const std::string& help,
+                      std::function<double()> value)
+{
+  add_family(Family{name, help, Type::counter, 0, 1, "", std::move(value)}, 0);
+}
+
+Metrics::Id Metrics::histogram(const std::string& name, const std::string& help)
+{
+  return add_family(Family{name, help, Type::histogram, 0, 1, "", {}}, HISTOGRAM_CELLS);
+}
+
+void Metrics::gauge(const std::string& name, const std::string& help,
+                    std::function<double()> value)
+{
+  add_family(Family{name, help, Type::gauge, 0, 1, "", std::move(value)}, 0);
+}
+
+void Metrics::collector(std::function<std::string()> render)
+{
+  collectors.push_back(std::move(render));
+}
+
+void Metrics::observe(Id histogram, std::chrono::nanoseconds duration)
+{
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  // Bucket b holds durations up to 2^b microseconds.
+  size_t bucket = us <= 1 ? 0 : std::bit_width(static_cast<uint64_t>(us - 1));
+  bucket = std::min(bucket, METRICS_BUCKETS);
+
+  std::atomic_uint64_t* cells = local() + histogram;
+  bump(cells[bucket], 1);
+  bump(cells[METRICS_BUCKETS + 1], static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+}
+
+std::atomic_uint64_t* Metrics::local()
+{
+  // The thread gives its shard back when it ends so that threads which come
+  // and go (like client handlers do) do not make the shards pile up.
+  struct Local {
+    std::shared_ptr<State> state;
+    Shard* shard = nullptr;
+
+    ~Local()
+    {
+      release();
+    }
+
+    void release()
+    {
+      if (state) {
+        std::lock_guard lk{state->mutex};
+        shard->in_use = false;
+      }
+      state = nullptr;
+      shard = nullptr;
+    }
+  };
+
+  thread_local Local cached;
+  if (cached.state == state) [[likely]]
+    return cached.shard->cells.get();
+
+  cached.release();
+  std::lock_guard lk{state->mutex};
+  state->frozen = true;
+
+  Shard* found = nullptr;
+  for (const std::unique_ptr<Shard>& shard : state->shards) {
+    if (!shard->in_use) {
+      found = shard.get();
+      break;
+    }
+  }
+
+  if (!found) {
+    state->shards.push_back(std::make_unique<Shard>());
+    found = state->shards.back().get();
+    found->cells = std::make_unique<std::atomic_uint64_t[]>(state->cells);
+  }
+
+  found->in_use = true;
+  cached.state = state;
+  cached.shard = found;
+  return found->cells.get();
+}
+
+uint64_t Metrics::sum(size_t cell) const
+{
+  std::lock_guard lk{state->mutex};
+  uint64_t total = 0;
+  for (const std::unique_ptr<Shard>& shard : state->shards)
+    total += shard->cells[cell].load(std::memory_order_relaxed);
+
+  return total;
+}
+
+std::string Metrics::render() const
+{
+  std::ostringstream out;
+  for (const Family& f : families) {
+    out << "# HELP " << f.name << " " << f.help << "\n";
+    switch (f.type) {
+    case Type::counter:
+      out << "# TYPE " << f.name << " counter\n";
+      if (f.gauge) {
+        out << f.name << " " << f.gauge() << "\n";
+      } else if (f.label_name.empty()) {
+        out << f.name << " " << sum(f.first) << "\n";
+      } else {
+        for (size_t l = 0; l < f.labels; ++l)
+          out << f.name << "{" << f.label_name << "=\"" << l << "\"} "
+              << sum(f.first + l) << "\n";
+      }
+      break;
+    case Type::histogram: {
+      out << "# TYPE " << f.name << " histogram\n";
+      uint64_t count = 0;
+      for (size_t b = 0; b < METRICS_BUCKETS; ++b) {
+        count += sum(f.first + b);
+        double le = static_cast<double>(uint64_t{1} << b) / 1e6;
+        out << f.name << "_bucket{le=\"" << le << "\"} " << count << "\n";
+      }
+      count += sum(f.first + METRICS_BUCKETS);
+      out << f.name << "_bucket{le=\"+Inf\"} " << count << "\n"
+          << f.name << "_sum " << static_cast<double>(sum(f.first + METRICS_BUCKETS + 1)) / 1e9
+          << "\n"
+          << f.name << "_count " << count << "\n";
+      break;
+    }
+    case Type::gauge:
+      out << "# TYPE " << f.name << " gauge\n"
+          << f.name << " " << f.gauge() << "\n";
+      break;
+    }
+  }
+
+  for (const std::function<std::string()>& render : collectors)
+    out << render();
+
+  return out.str();
+}
+
+void Metrics::serve(const std::string& path) const
+{
+  // A socket left behind by a previous run would make binding fail.
+  std::filesystem::remove(path);
+
+  boost::asio::io_context io_ctx;
+  stream_protocol::acceptor acceptor{io_ctx, stream_protocol::endpoint{path}};
+  dbg("[metrics] Serving metrics on ", path);
+
+  for (;;) {
+    try {
+      stream_protocol::socket sock{io_ctx};
+      acceptor.accept(sock);
+      std::string text = render();
+      boost::asio::write(sock, boost::asio::buffer(text));
+    } catch (std::exception& e) {
+      dbg("[metrics] Failed to serve metrics: ", e.what());
+    }
+  }
+}
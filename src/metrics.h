@@ -0,0 +1,124 @@
+// Runtime metrics of the server: counters, histograms and gauges.
+
+// Counters and histograms live in per-thread shards. A thread only ever writes
+// to its own shard so an update is a relaxed load and store on memory no other
+// thread writes to, there is no contention whatever the number of threads.
+// Reading sums all the shards up, which is the rare (and slow) side. Gauges
+// are point-in-time values computed by callbacks only when read, as are
+// counters kept elsewhere (eg. by the logger), exposed as counters still.
+//
+// All metrics are registered up front, before any thread updates them, and
+// the ids given out by registration are then used for updating.
+//
+// The text given out by render() is in the Prometheus exposition format, the
+// server serves it on a Unix socket to anyone who connects to it, eg.
+//   socat - UNIX-CONNECT:/tmp/bomberperson.sock
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Histograms count durations in power of two buckets of microseconds, from
+// 1us up to 2^(METRICS_BUCKETS - 1)us (about 8s), the rest goes to +Inf.
+constexpr size_t METRICS_BUCKETS = 24;
+
+class Metrics {
+public:
+  using Id = size_t;
+
+private:
+  enum class Type { counter, histogram, gauge };
+
+  struct Family {
+    std::string name;
+    std::string help;
+    Type type;
+    // Where in a shard its cells start.
+    size_t first;
+    // Counters can be split by a label (eg. client="3") into this many.
+    size_t labels;
+    std::string label_name;
+    // Value of a gauge or a counter read from a callback.
+    std::function<double()> gauge;
+  };
+
+  // Metrics rendered elsewhere (eg. by the lock profiler), appended as they
+  // are.
+  std::vector<std::function<std::string()>> collectors;
+
+  struct Shard {
+    std::unique_ptr<std::atomic_uint64_t[]> cells;
+    bool in_use = false;
+  };
+
+  // Shards outlive both the threads and the Metrics object, whichever goes
+  // first, so they are kept in a shared state.
+  struct State {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t cells = 0;
+    bool frozen = false;
+  };
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+  std::vector<Family> families;
+
+public:
+  Metrics() {}
+
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  // Registration, allowed only before the first update.
+  Id counter(const std::string& name, const std::string& help, size_t labels = 1,
+             const std::string& label_name = "");
+  Id histogram(const std::string& name, const std::string& help);
+  // A counter read from a callback, the value has to only ever grow.
+  void counter(const std::string& name, const std::string& help,
+               std::function<double()> value);
+  void gauge(const std::string& name, const std::string& help,
+             std::function<double()> value);
+  void collector(std::function<std::string()> render);
+
+  // Bump a counter, label being the index within a labelled counter.
+  void add(Id counter, uint64_t n = 1, size_t label = 0)
+  {
+    bump(local()[counter + label], n);
+  }
+
+  // Record a duration in a histogram.
+  void observe(Id histogram, std::chrono::nanoseconds duration);
+
+  // All metrics in the Prometheus text format.
+  std::string render() const;
+
+  // Serve render() to everyone who connects to the Unix socket at path. Never
+  // returns, meant to be run on a thread of its own.
+  void serve(const std::string& path) const;
+
+private:
+  // Single writer per shard so no read-modify-write is needed.
+  static void bump(std::atomic_uint64_t& cell, uint64_t n)
+  {
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Id add_family(Family&& family, size_t cells);
+
+  // Cells of the calling thread's shard.
+  std::atomic_uint64_t* local();
+
+  // Sum of a given cell over all shards.
+  uint64_t sum(size_t cell) const;
+};
+
+#endif  // _METRICS_H_
@@ -0,0 +1,156 @@
+// Bounded lock-free multi-producer single-consumer queue.
+
+// Producers claim cells of a ring with a single compare and swap, every cell
+// carries a sequence number telling whose turn it is to use it (the scheme is
+// due to Dmitry Vyukov). The consumer does not spin when the queue is empty,
+// it sleeps on an atomic counter (std::atomic::wait, a futex on Linux) and
+// producers only bother to wake it up when it actually sleeps.
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+
+template <typename T, size_t Capacity>
+class MpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity of the queue should be a power of two!");
+
+  static constexpr size_t mask = Capacity - 1;
+
+  struct alignas(64) Cell {
+    std::atomic_size_t seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+
+  // Producers' and the consumer's counters are kept apart not to share a line.
+  alignas(64) std::atomic_size_t tail = 0;
+  alignas(64) std::atomic_size_t head = 0;
+
+  // Bumped by producers who see the consumer sleeping, it waits on that.
+  alignas(64) std::atomic_uint32_t epoch = 0;
+  std::atomic_bool sleeping = false;
+public:
+  MpscQueue() : cells{new Cell[Capacity]}
+  {
+    for (size_t i = 0; i < Capacity; ++i)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Fails iff the queue is full, the value is left untouched then.
+  bool try_push(T&& value)
+  {
+    return emplace([&value] (T& cell) { cell = std::move(value); });
+  }
+
+  bool try_push(const T& value)
+  {
+    return emplace([&value] (T& cell) { cell = value; });
+  }
+
+  // Wait (politely) for a free cell if the queue happens to be full.
+  void push(T value)
+  {
+    while (!try_push(std::move(value)))
+      std::this_thread::yield();
+  }
+
+  // These two must only ever be called by the single consumer.
+  std::optional<T> try_pop()
+  {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Cell& cell = cells[pos & mask];
+
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+      return {};
+
+    std::optional<T> value{std::move(cell.value)};
+    cell.seq.store(pos + Capacity, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_relaxed);
+    return value;
+  }
+
+  T pop()
+  {
+    for (;;) {
+      if (std::optional<T> value = try_pop())
+        return std::move(*value);
+
+      uint32_t seen = epoch.load(std::memory_order_relaxed);
+      sleeping.store(true, std::memory_order_relaxed);
+      // Pairs with the fence in emplace: either the producer sees us sleeping
+      // or we see its element here.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (std::optional<T> value = try_pop()) {
+        sleeping.store(false, std::memory_order_relaxed);
+        return std::move(*value);
+      }
+
+      epoch.wait(seen, std::memory_order_relaxed);
+      sleeping.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  // Approximate number of elements waiting, fine for statistics.
+  size_t size() const
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+
+  static constexpr size_t capacity()
+  {
+    return Capacity;
+  }
+
+private:
+  template <typename F>
+  bool emplace(F&& fill)
+  {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    fill(cell->value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    // Only touch the shared counter (and the futex) when the consumer sleeps
+    // and then only one of the producers wakes it up.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) &&
+        sleeping.exchange(false, std::memory_order_relaxed)) {
+      epoch.fetch_add(1, std::memory_order_relaxed);
+      epoch.notify_one();
+    }
+
+    return true;
+  }
+};
+
+#endif  // _QUEUE_H_
@@ -0,0 +1,90 @@
+// Token buckets limiting how much a single client may send.
+
+// A bucket holds up to a burst of tokens and gains rate of them every second,
+// anything wanting more than there is gets refused. Each client's input goes
+// through an InputLimiter of two buckets, one counting messages and the other
+// bytes, so that neither a stream of tiny moves nor a few huge Joins get in
+// in bulk. Both hold a second's worth of tokens, which is plenty for anyone
+// pressing keys. A rate of zero means no limit. A limiter belongs to the one
+// thread reading the client's input and is not synchronised.
+
+#ifndef _RATE_LIMIT_H_
+#define _RATE_LIMIT_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+class TokenBucket {
+  using clock = std::chrono::steady_clock;
+
+  double rate;
+  double burst;
+  double tokens;
+  clock::time_point last;
+public:
+  TokenBucket(double rate, double burst, clock::time_point now)
+    : rate{rate}, burst{burst}, tokens{burst}, last{now} {}
+
+  // Add what has been gained since the last time.
+  void refill(clock::time_point now)
+  {
+    double seconds = std::chrono::duration<double>(now - last).count();
+    tokens = std::min(burst, tokens + seconds * rate);
+    last = now;
+  }
+
+  bool has(double n) const
+  {
+    return rate == 0 || tokens >= n;
+  }
+
+  void take(double n)
+  {
+    if (rate != 0)
+      tokens -= n;
+  }
+
+  // How long until there are n tokens, when refilled then.
+  std::chrono::nanoseconds until(double n) const
+  {
+    if (rate == 0)
+      return std::chrono::nanoseconds{0};
+
+    double seconds = std::max(0.0, n - tokens) / rate;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::duration<double>(seconds));
+  }
+};
+
+class InputLimiter {
+  using clock = std::chrono::steady_clock;
+
+  TokenBucket messages;
+  TokenBucket bytes;
+public:
+  InputLimiter(double messages_per_sec, double bytes_per_sec, clock::time_point now = clock::now())
+    : messages{messages_per_sec, messages_per_sec, now}, bytes{bytes_per_sec, bytes_per_sec, now} {}
+
+  // Let a message of this size in, taking from both buckets, or from none
+  // when it is refused.
+  bool admit(size_t size, clock::time_point now = clock::now())
+  {
+    messages.refill(now);
+    bytes.refill(now);
+    if (!messages.has(1) || !bytes.has(static_cast<double>(size)))
+      return false;
+
+    messages.take(1);
+    bytes.take(static_cast<double>(size));
+    return true;
+  }
+
+  // How long until a message of this size would be let in.
+  std::chrono::nanoseconds backoff(size_t size) const
+  {
+    return std::max(messages.until(1), bytes.until(static_cast<double>(size)));
+  }
+};
+
+#endif  // _RATE_LIMIT_H_
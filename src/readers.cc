@@ -33,14 +33,45 @@ void ReaderUDP::sock_fill(udp::socket& sock)
   pos = 0;
 }
 
-std::vector<uint8_t> ReaderTCP::read(size_t nbytes)
+void ReaderUDP::filled(size_t nbytes)
+{
+  buff_size = nbytes;
+  pos = 0;
+}
+
+std::vector<uint8_t> ReaderStream::read(size_t nbytes)
 {
   std::vector<uint8_t> bytes(nbytes);
   boost::asio::read(sock, boost::asio::buffer(bytes, nbytes));
   return bytes;
 }
 
-size_t ReaderTCP::avalaible() const
+size_t ReaderStream::avalaible() const
 {
   return sock.available();
 }
+
+std::vector<uint8_t> ReaderMemory::read(size_t nbytes)
+{
+  if (nbytes > size - pos) {
+    short_read = true;
+    throw std::runtime_error{"Not enough bytes in the buffer!"};
+  }
+
+  std::vector<uint8_t> bytes(data + pos, data + pos + nbytes);
+  pos += nbytes;
+  return bytes;
+}
+
+size_t ReaderMemory::avalaible() const
+{
+  return size - pos;
+}
+
+void ReaderMemory::seek(size_t new_pos)
+{
+  if (new_pos > size)
+    throw std::runtime_error{"Seeking past the end of the buffer!"};
+
+  pos = new_pos;
+}
@@ -6,6 +6,7 @@
 #define _READERS_H_
 
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <cstddef>
@@ -24,17 +25,55 @@ public:
   // Fill the reader with a udp socket.
   void sock_fill(boost::asio::ip::udp::socket& sock);
 
+  // Or receive a datagram into buffer() asynchronously and then say how
+  // long it was.
+  boost::asio::mutable_buffer buffer()
+  {
+    return boost::asio::buffer(buff);
+  }
+
+  void filled(size_t nbytes);
+
+  std::vector<uint8_t> read(size_t nbytes);
+  size_t avalaible() const;
+};
+
+// Reads from a stream socket, be it TCP or a Unix one.
+class ReaderStream {
+  boost::asio::generic::stream_protocol::socket& sock;
+public:
+  ReaderStream(boost::asio::generic::stream_protocol::socket& sock) : sock(sock) {}
+
   std::vector<uint8_t> read(size_t nbytes);
   size_t avalaible() const;
 };
 
-class ReaderTCP {
-  boost::asio::ip::tcp::socket& sock;
+// Reads from a chunk of memory (eg. a mapped file) which it does not own.
+class ReaderMemory {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  size_t pos = 0;
+  bool short_read = false;
 public:
-  ReaderTCP(boost::asio::ip::tcp::socket& sock) : sock(sock) {}
+  ReaderMemory() {}
+  ReaderMemory(const uint8_t* data, size_t size) : data{data}, size{size} {}
 
   std::vector<uint8_t> read(size_t nbytes);
   size_t avalaible() const;
+
+  size_t position() const
+  {
+    return pos;
+  }
+
+  void seek(size_t new_pos);
+
+  // Whether a read has wanted more than there was, ie. the data is cut short
+  // rather than malformed.
+  bool exhausted() const
+  {
+    return short_read;
+  }
 };
 
 #endif  // _READERS_H_
@@ -1,14 +1,19 @@
 // Client for the bomberperson game.
 
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/resolver_base.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/program_options.hpp>
+#include <boost/system/system_error.hpp>
+#include <array>
 #include <map>
+#include <optional>
 #include <set>
-#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <regex>
@@ -24,6 +29,7 @@
 #include "readers.h"
 #include "marshal.h"
 #include "messages.h"
+#include "trace.h"
 #include "dbg.h"
 
 namespace po = boost::program_options;
@@ -32,6 +38,9 @@ using boost::asio::ip::udp;
 using boost::asio::ip::tcp;
 using boost::asio::ip::resolver_base;
 
+namespace generic = boost::asio::generic;
+namespace local = boost::asio::local;
+
 using input_messages::InputMessage;
 using display_messages::DisplayMessage;
 using server_messages::ServerMessage;
@@ -40,6 +49,9 @@ using client_messages::ClientMessage;
 namespace
 {
 
+// Bytes read from the server at once, messages may span several reads.
+constexpr size_t SERVER_READ_SIZE = 4096;
+
 template <typename T>
 concept LobbyOrGame = std::same_as<T, display_messages::Lobby> ||
   std::same_as<T, display_messages::Game>;
@@ -53,12 +65,21 @@ public:
 // Helper for std::visiting mimicking pattern matching, inspired by cppref.
 template<typename> inline constexpr bool always_false_v = false;
 
+// Split the address into host and port or, for a server on this machine's
+// Unix socket given as unix:/path, into "unix" and the path.
 std::pair<std::string, std::string> get_addr(const std::string& addr)
 {
   static const std::regex r("^(.*):(\\d+)$");
+  static const std::string unix_prefix = "unix:";
   std::smatch sm;
 
-  if (std::regex_search(addr, sm, r)) {
+  if (addr.starts_with(unix_prefix)) {
+    std::string path = addr.substr(unix_prefix.length());
+    if (path.empty())
+      throw ClientError{"Invalid address!"};
+
+    return {"unix", path};
+  } else if (std::regex_search(addr, sm, r)) {
     std::string ip = sm[1].str();
 
     // Allow IPv6 adresses like [::1] which boost's resolver does not resolve.
@@ -96,63 +117,112 @@ struct GameState {
 };
 
 // Main class representing the client.
+
+// Everything happens on a single io_context, which may be shared by several
+// clients (sessions) at once: the server's messages and the gui's datagrams
+// are received asynchronously and handled in the completion handlers, one at
+// a time, so the game state needs no synchronisation. Whatever ends a session
+// (the server gone, the gui unreachable...) closes its sockets, which cancels
+// what it waits for, and is rethrown once the io_context has run out of work.
 class RoboticClient {
-  boost::asio::io_context io_ctx;
+  boost::asio::io_context& io_ctx;
   std::string name;
-  tcp::socket server_socket;
+  // Either a TCP or a Unix socket, both speak the same protocol.
+  generic::stream_protocol::socket server_socket;
   udp::socket gui_socket;
   udp::socket gui_send_socket;
   udp::endpoint gui_endpoint;
-  tcp::endpoint server_endpoint;
+  // Messages for the server wait in server_ser while a write is in flight.
   Serialiser server_ser;
+  std::vector<uint8_t> server_writing;
   Serialiser gui_ser;
-  Deserialiser<ReaderTCP> server_deser{server_socket};
+  // What came from the server and does not make a whole message yet.
+  std::array<uint8_t, SERVER_READ_SIZE> server_chunk;
+  std::vector<uint8_t> server_input;
   Deserialiser<ReaderUDP> gui_deser;
   GameState game_state;
 
-  // Propagate exceptions between threads.
+  // Optional latency tracing (see trace.h), inputs go to lane 0 and messages
+  // from the server to lane 1.
+  Tracer tracer;
+  std::optional<std::string> trace_file;
+
+  // What ended the session, rethrown by finish.
   std::exception_ptr exception;
 public:
-  RoboticClient(const std::string& name, uint16_t port,
+  RoboticClient(boost::asio::io_context& io_ctx, const std::string& name, uint16_t port,
                 const std::string& server_addr, const std::string& gui_addr)
-    : name{name}, server_socket{io_ctx}, gui_socket{io_ctx, udp::endpoint{udp::v6(), port}},
+    : io_ctx{io_ctx}, name{name}, server_socket{io_ctx}, gui_socket{io_ctx, udp::endpoint{udp::v6(), port}},
       gui_send_socket{io_ctx}
   {
     auto [gui_ip, gui_port] = get_addr(gui_addr);
+    if (gui_ip == "unix")
+      throw ClientError{"The gui is reached over UDP, not a Unix socket!"};
+
     udp::resolver udp_resolver{io_ctx};
     gui_endpoint = *udp_resolver.resolve(gui_ip, gui_port, resolver_base::numeric_service);
 
-    auto [serv_ip, serv_port] = get_addr(server_addr);
-    tcp::resolver tcp_resolver{io_ctx};
-    server_endpoint =
-      *tcp_resolver.resolve(serv_ip, serv_port, resolver_base::numeric_service);
-
     // Open connection to the server.
-    server_socket.connect(server_endpoint);
-    tcp::no_delay option(true);
-    server_socket.set_option(option);
+    auto [serv_ip, serv_port] = get_addr(server_addr);
+    if (serv_ip == "unix") {
+      local::stream_protocol::socket sock{io_ctx};
+      sock.connect(local::stream_protocol::endpoint{serv_port});
+      server_socket = std::move(sock);
+      dbg("Server's socket: ", serv_port);
+    } else {
+      tcp::resolver tcp_resolver{io_ctx};
+      tcp::endpoint server_endpoint =
+        *tcp_resolver.resolve(serv_ip, serv_port, resolver_base::numeric_service);
+      tcp::socket sock{io_ctx};
+      sock.connect(server_endpoint);
+      tcp::no_delay option(true);
+      sock.set_option(option);
+      server_socket = std::move(sock);
+      dbg("Server's endpoint: ", server_endpoint);
+    }
 
     // Socket for sending to gui is a connected one, thus we know whether gui
     // receives our messages.
     gui_send_socket.connect(gui_endpoint);
 
     dbg("Gui's endpoint: ", gui_endpoint);
-    dbg("Server's endpoint: ", server_endpoint);
     dbg("Listening to gui messages on ", gui_socket.local_endpoint());
   }
 
-  // Main function for actually playing the game.
+  // Trace one in sample_every inputs and server messages into a Chrome trace
+  // file, saved after every game. Call before play.
+  void trace_to(const std::string& file, uint32_t sample_every)
+  {
+    trace_file = file;
+    tracer.enable(sample_every);
+  }
+
+  // Start receiving from the server and the gui. The session goes on as long
+  // as io_ctx runs, until one of them fails.
+  void start();
+
+  // Once io_ctx has run out of work: save the trace and rethrow whatever
+  // ended the session.
+  void finish();
+
+  // Main function for actually playing the game, a session of its own.
   void play();
   
 private:
-  // This function will be executed by one of the threads to receive input form
-  // the gui and send it forward to the server.
+  // Receive input from the gui and send it forward to the server.
+  void receive_input();
   void input_handler();
+  void send_to_server();
 
-  // Another thread reads messages from the server and updates the game state by
-  // aggregating all of the information received from the server. Then after each
-  // such update it should tell the gui to show what is going on appropriately.
+  // Read messages from the server and update the game state by aggregating
+  // all of the information received from the server. Then after each such
+  // update tell the gui to show what is going on appropriately.
+  void receive_server();
   void game_handler();
+  void message_handler(ServerMessage& msg);
+
+  // End the session, unless it has ended already.
+  void fail(std::exception_ptr e);
 
   // Game'ise the lobby, convets the held game _state.state.
   void lobby_to_game();
@@ -353,7 +423,6 @@ void RoboticClient::ge_handler(server_messages::GameEnded& ge)
 {
   dbg("[game_handler] ge_handler");
   using namespace display_messages;
-  // The lobby flag gets concurrently modified but we are fine with that.
   game_state.lobby = true;
   game_state.bombs = {};
   game_state.old_blocks = {};
@@ -441,6 +510,37 @@ ClientMessage RoboticClient::input_to_client(InputMessage& msg)
     }, msg);
 }
 
+void RoboticClient::fail(std::exception_ptr e)
+{
+  if (exception)
+    return;
+
+  exception = e;
+  // Pending receives and writes complete as cancelled and start no more.
+  boost::system::error_code ignored;
+  server_socket.close(ignored);
+  gui_socket.close(ignored);
+  gui_send_socket.close(ignored);
+}
+
+void RoboticClient::receive_input()
+{
+  dbg("[input_handler] Waiting for input...");
+  gui_socket.async_receive(gui_deser.readable().buffer(),
+                           [this] (boost::system::error_code ec, size_t nbytes) {
+      if (ec) {
+        dbg("[input_handler] Failed to receive from gui: ", ec.message());
+        fail(std::make_exception_ptr(ClientError{"Failed to read from gui."}));
+        return;
+      }
+
+      gui_deser.readable().filled(nbytes);
+      input_handler();
+      if (!exception)
+        receive_input();
+    });
+}
+
 void RoboticClient::input_handler()
 {
   using namespace client_messages;
@@ -448,106 +548,153 @@ void RoboticClient::input_handler()
   ClientMessage msg;
   InputMessage inp;
 
-  for (;;) {
-    dbg("[input_handler] Waiting for input...");
-    gui_deser.readable().sock_fill(gui_socket);
+  bool traced = tracer.sample();
+  int64_t received = traced ? Tracer::now() : 0;
 
-    try {
-      gui_deser >> inp;
-      gui_deser.no_trailing_bytes();
-    } catch (UnmarshallingError& e) {
-      dbg("[input_handler] Invalid input (ignored): ", e.what());
-      if (exception) {
-        dbg("[input_handler] Some exception happened in another thread, exiting.");
+  try {
+    gui_deser >> inp;
+    gui_deser.no_trailing_bytes();
+  } catch (UnmarshallingError& e) {
+    dbg("[input_handler] Invalid input (ignored): ", e.what());
+    return;
+  }
+
+  if (game_state.lobby) {
+    dbg("[input_handler] First input in the lobby, sending Join.");
+    game_state.lobby = false;
+    msg = Join{name};
+  } else {
+    msg = input_to_client(inp);
+  }
+
+  server_ser << msg;
+  send_to_server();
+
+  if (traced)
+    tracer.span("input", 0, received, Tracer::now());
+}
+
+void RoboticClient::send_to_server()
+{
+  // One write at a time, what comes meanwhile goes with the next one.
+  if (!server_writing.empty() || server_ser.size() == 0)
+    return;
+
+  server_writing = server_ser.drain_bytes();
+  dbg("[input_handler] Sending ", server_writing.size(), " bytes to the server");
+  boost::asio::async_write(server_socket, boost::asio::buffer(server_writing),
+                           [this] (boost::system::error_code ec, size_t) {
+      if (ec) {
+        dbg("[input_handler] An exception occured while trying to write to the server.");
+        fail(std::make_exception_ptr(ClientError{"Failed to write to server."}));
         return;
       }
 
-      continue;
-    }
-
-    if (game_state.lobby) {
-      dbg("[input_handler] First input in the lobby, sending Join.");
-      game_state.lobby = false;
-      msg = Join{name};
-    } else {
-      msg = input_to_client(inp);
-    }
+      server_writing.clear();
+      send_to_server();
+    });
+}
 
-    server_ser << msg;
-    dbg("[input_handler] Sending ", server_ser.size(), " bytes to the server");
-    try {
-      server_socket.send(boost::asio::buffer(server_ser.drain_bytes()));
-    } catch (std::exception& e) {
-      dbg("[input_handler] An exception occured while trying to write to the server.");
-      exception = std::make_exception_ptr(ClientError{"Failed to write to server."});
-      // Close the socket the second thread waits on so it can exit too.
-      try {
-        server_socket.shutdown(server_socket.shutdown_receive);
-        gui_socket.shutdown(gui_socket.shutdown_both);
-      } catch (std::exception& ignored) {}
+void RoboticClient::receive_server()
+{
+  dbg("[game_handler] Tying to read a message from server...");
+  server_socket.async_read_some(boost::asio::buffer(server_chunk),
+                                [this] (boost::system::error_code ec, size_t nbytes) {
+      if (ec) {
+        dbg("[game_handler] An exception occured while reading from the server: ",
+            ec.message());
+        fail(std::make_exception_ptr(boost::system::system_error{ec}));
+        return;
+      }
 
-      return;
-    }
-  }
+      server_input.insert(server_input.end(), server_chunk.begin(),
+                          server_chunk.begin() + static_cast<ptrdiff_t>(nbytes));
+      game_handler();
+      if (!exception)
+        receive_server();
+    });
 }
 
 void RoboticClient::game_handler()
 {
-  ServerMessage updt;
-  DisplayMessage msg;
-
-  for (;;) {
-    dbg("[game_handler] Tying to read a message from server...");
+  // Handle every whole message there is, the rest waits for more bytes.
+  size_t used = 0;
+  while (!exception && used < server_input.size()) {
+    Deserialiser<ReaderMemory> deser{ReaderMemory{server_input.data() + used,
+                                                  server_input.size() - used}};
+    ServerMessage updt;
     try {
-      server_deser >> updt;
+      deser >> updt;
     } catch (std::exception& e) {
-      dbg("[game_handler] An exception occured while reading from the server: ", e.what());
-      exception = std::current_exception();
-      // Close the socket the second thread waits on so it can exit too.
-      try {
-        gui_socket.shutdown(gui_socket.shutdown_receive);
-        server_socket.shutdown(server_socket.shutdown_both);
-      } catch (std::exception& ignored) {}
+      if (deser.readable().exhausted())
+        break;
 
+      dbg("[game_handler] An exception occured while reading from the server: ", e.what());
+      fail(std::current_exception());
       return;
     }
 
-    dbg("[game_handler] Message read, proceeding to handle it!");
-    game_state.started = false;
-    server_msg_handler(updt);
-
-    update_game();
-
-    // Apparently we should not send anything to gui after GameStarted.
-    if (!game_state.started) {
-      gui_ser << game_state.state;
-      dbg("[game_handler] Sending ", gui_ser.size(), " bytes to gui.");
-      try {
-        gui_send_socket.send(boost::asio::buffer(gui_ser.drain_bytes()));
-      } catch (std::exception& e) {
-        dbg("[game_handler] Failed to send to gui: ", e.what());
-        exception = std::make_exception_ptr(ClientError{"Failed to write to gui."});
-        try {
-          gui_socket.shutdown(gui_socket.shutdown_receive);
-          server_socket.shutdown(server_socket.shutdown_both);
-      } catch (std::exception& ignored) {}
+    used += deser.readable().position();
+    message_handler(updt);
+  }
 
-        return;
-      }
+  server_input.erase(server_input.begin(), server_input.begin() + static_cast<ptrdiff_t>(used));
+}
+
+void RoboticClient::message_handler(ServerMessage& updt)
+{
+  dbg("[game_handler] Message read, proceeding to handle it!");
+  bool traced = tracer.sample();
+  int64_t read = traced ? Tracer::now() : 0;
+  bool ended = std::holds_alternative<server_messages::GameEnded>(updt);
+  game_state.started = false;
+  server_msg_handler(updt);
+
+  update_game();
+
+  // Apparently we should not send anything to gui after GameStarted.
+  if (!game_state.started) {
+    gui_ser << game_state.state;
+    dbg("[game_handler] Sending ", gui_ser.size(), " bytes to gui.");
+    // A datagram does not wait for the gui to take it.
+    boost::system::error_code ec;
+    gui_send_socket.send(boost::asio::buffer(gui_ser.drain_bytes()), 0, ec);
+    if (ec) {
+      dbg("[game_handler] Failed to send to gui: ", ec.message());
+      fail(std::make_exception_ptr(ClientError{"Failed to write to gui."}));
+      return;
     }
   }
+
+  if (traced)
+    tracer.span("server message", 1, read, Tracer::now());
+
+  if (ended && trace_file.has_value())
+    tracer.dump(trace_file.value(), "robots-client");
 }
 
-void RoboticClient::play()
+void RoboticClient::start()
 {
-  std::jthread game_worker{[this] { game_handler(); }};
-  // Why waste the main thread, input_handler can have it.
-  input_handler();
+  receive_server();
+  receive_input();
+}
+
+void RoboticClient::finish()
+{
+  if (trace_file.has_value())
+    tracer.dump(trace_file.value(), "robots-client");
 
   if (exception)
     std::rethrow_exception(exception);
 }
 
+void RoboticClient::play()
+{
+  start();
+  io_ctx.run();
+  finish();
+}
+
 };  // namespace anonymous
 
 int main(int argc, char* argv[])
@@ -557,6 +704,8 @@ int main(int argc, char* argv[])
     std::string gui_addr;
     std::string player_name;
     std::string server_addr;
+    uint32_t trace_sample;
+    std::string log_level;
     po::options_description desc{"Allowed flags for the robotic client"};
     desc.add_options()
       ("help,h", "produce this help message")
@@ -564,9 +713,15 @@ int main(int argc, char* argv[])
        "gui address, IPv4:port or IPv6:port or hostname:port")
       ("player-name,n", po::value<std::string>(&player_name)->required(), "player name")
       ("server-address,s", po::value<std::string>(&server_addr)->required(),
-       "server address, same format as gui address")
+       "server address, same format as gui address or unix:/path for a local server")
       ("port,p", po::value<uint16_t>(&portnum)->required(),
        "listen to gui on a port.")
+      ("trace", po::value<std::string>(),
+       "trace latency of inputs and server messages into this Chrome trace file")
+      ("trace-sample", po::value<uint32_t>(&trace_sample)->default_value(1),
+       "trace one in this many inputs and messages")
+      ("log-level", po::value<std::string>(&log_level)->default_value(debug ? "debug" : "info"),
+       "log level: debug, info, warn, error or off")
     ;
 
     po::variables_map vm;
@@ -583,8 +738,14 @@ int main(int argc, char* argv[])
     // Notify about missing options only after printing help.
     po::notify(vm);
 
+    set_log_level(log_level_from_name(log_level));
+
     player_name = player_name.substr(0, std::numeric_limits<uint8_t>::max());
-    RoboticClient client{player_name, portnum, server_addr, gui_addr};
+    boost::asio::io_context io_ctx;
+    RoboticClient client{io_ctx, player_name, portnum, server_addr, gui_addr};
+    if (vm.count("trace"))
+      client.trace_to(vm["trace"].as<std::string>(), trace_sample);
+
     client.play();
 
   } catch (po::required_option& e) {
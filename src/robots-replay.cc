@@ -0,0 +1,386 @@
+// Replaying games saved by the server's journal (see journal.h).
+
+// Without flags it just reads a journal through and tells what's inside. With
+// --serve it pretends to be the server that played the game: it waits for one
+// client and plays the recorded messages to it turn by turn, optionally faster
+// or slower than originally and starting from any turn (the turns before are
+// sent right away, just like a late joiner gets them from a live server).
+//
+// With --feed instead of a journal it follows a running server's feed (see
+// feed.h), telling what goes on as it happens.
+
+#include <boost/asio.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/program_options.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "feed.h"
+#include "journal.h"
+#include "marshal.h"
+#include "messages.h"
+#include "readers.h"
+
+namespace po = boost::program_options;
+
+using boost::asio::ip::tcp;
+
+using server_messages::ServerMessage;
+
+namespace
+{
+
+class ReplayError : public std::runtime_error {
+public:
+  ReplayError() : runtime_error{"Replay error!"} {}
+  ReplayError(const std::string& msg) : runtime_error{msg} {}
+};
+
+// Read-only mapping of the whole journal.
+class MappedJournal {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+public:
+  MappedJournal(const std::string& path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw ReplayError{"Cannot open the journal " + path + "!"};
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      throw ReplayError{"Cannot stat the journal " + path + "!"};
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    if (size > 0) {
+      void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (addr == MAP_FAILED)
+        throw ReplayError{"Cannot map the journal " + path + "!"};
+      data = static_cast<const uint8_t*>(addr);
+    } else {
+      close(fd);
+    }
+  }
+
+  ~MappedJournal()
+  {
+    if (data)
+      munmap(const_cast<uint8_t*>(data), size);
+  }
+
+  MappedJournal(const MappedJournal&) = delete;
+  MappedJournal& operator=(const MappedJournal&) = delete;
+
+  ReaderMemory reader() const
+  {
+    return ReaderMemory{data, size};
+  }
+
+  const uint8_t* bytes() const
+  {
+    return data;
+  }
+
+  size_t length() const
+  {
+    return size;
+  }
+};
+
+// Read the next message, empty optional if the journal ends (even abruptly,
+// when the server died mid-game).
+std::optional<ServerMessage> next_message(Deserialiser<ReaderMemory>& deser)
+{
+  if (deser.avalaible() == 0)
+    return {};
+
+  size_t pos = deser.readable().position();
+  try {
+    ServerMessage msg;
+    deser >> msg;
+    return msg;
+  } catch (UnmarshallingError& e) {
+    std::cerr << "Journal cut short at byte " << pos << ": " << e.what() << "\n";
+    deser.readable().seek(deser.readable().position() + deser.avalaible());
+    return {};
+  }
+}
+
+void print_hello(const server_messages::Hello& hello)
+{
+  auto& [name, count, size_x, size_y, game_len, radius, timer] = hello;
+  std::cout << "server:\t\t" << name << "\n"
+            << "board:\t\t" << size_x << "x" << size_y << "\n"
+            << "game length:\t" << game_len << "\n"
+            << "players count:\t" << +count << "\n"
+            << "radius:\t\t" << radius << "\n"
+            << "bomb timer:\t" << timer << "\n";
+}
+
+void print_stats(const MappedJournal& journal, const std::string& path)
+{
+  Deserialiser<ReaderMemory> deser{journal.reader()};
+  std::array<uint64_t, std::variant_size_v<ServerMessage>> messages{};
+  std::array<uint64_t, std::variant_size_v<server_messages::Event>> events{};
+  std::optional<uint16_t> last_turn;
+  server_messages::GameStarted players;
+  server_messages::GameEnded scores;
+
+  while (std::optional<ServerMessage> msg = next_message(deser)) {
+    ++messages[msg->index()];
+    if (auto* hello = std::get_if<server_messages::Hello>(&msg.value())) {
+      print_hello(*hello);
+    } else if (auto* gs = std::get_if<server_messages::GameStarted>(&msg.value())) {
+      players = *gs;
+    } else if (auto* turn = std::get_if<server_messages::Turn>(&msg.value())) {
+      last_turn = turn->first;
+      for (const server_messages::Event& ev : turn->second)
+        ++events[ev.index()];
+    } else if (auto* ge = std::get_if<server_messages::GameEnded>(&msg.value())) {
+      scores = *ge;
+    }
+  }
+
+  std::cout << "bytes:\t\t" << journal.length() << "\n"
+            << "turns:\t\t" << messages[3] << "\n";
+  if (last_turn.has_value())
+    std::cout << "last turn:\t" << last_turn.value() << "\n";
+
+  std::cout << "bombs placed:\t" << events[0] << "\n"
+            << "explosions:\t" << events[1] << "\n"
+            << "moves:\t\t" << events[2] << "\n"
+            << "blocks placed:\t" << events[3] << "\n"
+            << "finished:\t" << (messages[4] > 0 ? "yes" : "no") << "\n";
+
+  for (auto& [id, player] : players) {
+    std::cout << "player " << +id << ":\t" << player.first << " (" << player.second << ")";
+    if (scores.contains(id))
+      std::cout << ", died " << scores.at(id) << " times";
+    std::cout << "\n";
+  }
+
+  std::optional<JournalIndex> idx = JournalIndex::load(path);
+  if (idx.has_value())
+    std::cout << "index:\t\t" << idx->size() << " entries, every "
+              << idx->index_stride() << " turns\n";
+  else
+    std::cout << "index:\t\tnone\n";
+}
+
+// Find where turn from_turn starts: the index gets us close, the rest of the
+// way is walked message by message.
+size_t find_turn(const MappedJournal& journal, const std::string& path, uint16_t from_turn)
+{
+  Deserialiser<ReaderMemory> deser{journal.reader()};
+
+  std::optional<JournalIndex> idx = JournalIndex::load(path);
+  std::optional<std::pair<uint16_t, uint64_t>> entry;
+  if (idx.has_value())
+    entry = idx->seek(from_turn);
+
+  if (entry.has_value() && entry->second <= journal.length())
+    deser.readable().seek(entry->second);
+  else
+    std::cerr << "No usable index, walking the journal from the start.\n";
+
+  for (;;) {
+    size_t pos = deser.readable().position();
+    std::optional<ServerMessage> msg = next_message(deser);
+    if (!msg.has_value())
+      return pos;
+
+    auto* turn = std::get_if<server_messages::Turn>(&msg.value());
+    if (turn && turn->first >= from_turn)
+      return pos;
+    if (std::holds_alternative<server_messages::GameEnded>(msg.value()))
+      return pos;
+  }
+}
+
+void serve(const MappedJournal& journal, const std::string& path, uint16_t port,
+           uint16_t from_turn, uint64_t turn_duration, double speed)
+{
+  size_t start = find_turn(journal, path, from_turn);
+
+  boost::asio::io_context io_ctx;
+  tcp::acceptor acceptor{io_ctx, tcp::endpoint{tcp::v6(), port}};
+  std::cout << "Waiting for a client on " << acceptor.local_endpoint() << "\n";
+
+  tcp::socket sock{io_ctx};
+  acceptor.accept(sock);
+  sock.set_option(tcp::no_delay{true});
+  std::cout << "Replaying to " << sock.remote_endpoint() << " from byte " << start << "\n";
+
+  // Everything before the starting turn goes at once.
+  boost::asio::write(sock, boost::asio::buffer(journal.bytes(), start));
+
+  auto pause = std::chrono::microseconds{0};
+  if (speed > 0)
+    pause = std::chrono::microseconds{
+      static_cast<int64_t>(static_cast<double>(turn_duration) * 1000 / speed)};
+
+  Deserialiser<ReaderMemory> deser{journal.reader()};
+  deser.readable().seek(start);
+  auto deadline = std::chrono::steady_clock::now();
+  for (;;) {
+    size_t pos = deser.readable().position();
+    std::optional<ServerMessage> msg = next_message(deser);
+    if (!msg.has_value())
+      break;
+
+    if (std::holds_alternative<server_messages::Turn>(msg.value())) {
+      std::this_thread::sleep_until(deadline);
+      deadline += pause;
+    }
+
+    size_t len = deser.readable().position() - pos;
+    boost::asio::write(sock, boost::asio::buffer(journal.bytes() + pos, len));
+  }
+
+  std::cout << "Replay done.\n";
+}
+
+// Tell what happens in the games published to the feed, until killed.
+void follow(const std::string& name)
+{
+  FeedReader feed{name};
+
+  std::span<const uint8_t> hello_bytes = feed.hello();
+  Deserialiser<ReaderMemory> hello_deser{ReaderMemory{hello_bytes.data(), hello_bytes.size()}};
+  ServerMessage hello;
+  hello_deser >> hello;
+  if (!std::holds_alternative<server_messages::Hello>(hello))
+    throw ReplayError{"The feed does not start with a Hello!"};
+  print_hello(std::get<server_messages::Hello>(hello));
+
+  uint64_t overruns = 0;
+  for (;;) {
+    std::optional<std::span<const uint8_t>> bytes = feed.peek();
+    if (feed.overruns() != overruns) {
+      overruns = feed.overruns();
+      std::cout << "overrun, skipped to the newest message (" << overruns << " so far)\n";
+    }
+    if (!bytes.has_value()) {
+      std::cout.flush();
+      // The server publishes a turn every few dozen milliseconds at most.
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      continue;
+    }
+
+    ServerMessage msg;
+    bool broken = false;
+    try {
+      Deserialiser<ReaderMemory> deser{ReaderMemory{bytes->data(), bytes->size()}};
+      deser >> msg;
+    } catch (UnmarshallingError&) {
+      broken = true;
+    }
+
+    // Whatever was read is only good if the server has not written over it.
+    if (!feed.done())
+      continue;
+    if (broken)
+      throw ReplayError{"Unreadable message in the feed!"};
+
+    if (auto* gs = std::get_if<server_messages::GameStarted>(&msg)) {
+      std::cout << "game started:";
+      for (auto& [id, player] : *gs)
+        std::cout << " " << +id << "=" << player.first;
+      std::cout << "\n";
+    } else if (auto* turn = std::get_if<server_messages::Turn>(&msg)) {
+      std::cout << "turn " << turn->first << ":\t" << turn->second.size() << " events\n";
+    } else if (auto* ge = std::get_if<server_messages::GameEnded>(&msg)) {
+      std::cout << "game ended:";
+      for (auto [id, score] : *ge)
+        std::cout << " " << +id << "=" << score;
+      std::cout << " deaths\n";
+    }
+  }
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    std::string path;
+    uint16_t port;
+    uint16_t from_turn;
+    uint64_t turn_duration;
+    double speed;
+
+    po::options_description desc{"Allowed flags for the replay tool"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("journal,j", po::value<std::string>(&path),
+       "journal file written by the server")
+      ("feed", po::value<std::string>(),
+       "follow the feed a running server publishes (its --feed) instead")
+      ("serve,p", po::value<uint16_t>(&port),
+       "play the game to a client connecting on this port")
+      ("from-turn,f", po::value<uint16_t>(&from_turn)->default_value(0),
+       "start replaying at this turn")
+      ("turn-duration,d", po::value<uint64_t>(&turn_duration)->default_value(500),
+       "turn duration in milliseconds the game was played with")
+      ("speed,v", po::value<double>(&speed)->default_value(1.0),
+       "replay speed multiplier, 0 means as fast as possible")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).
+              options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "\t\tBOMBERPERSON\n";
+      std::cout << "Usage: " << argv[0] <<  " -j journal [flags] | --feed name\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (speed < 0)
+      throw ReplayError{"Speed cannot be negative!"};
+
+    if (vm.count("feed")) {
+      follow(vm["feed"].as<std::string>());
+      return 0;
+    }
+
+    if (!vm.count("journal"))
+      throw ReplayError{"Need a journal (or a feed)!"};
+
+    MappedJournal journal{path};
+    if (vm.count("serve"))
+      serve(journal, path, port, from_turn, turn_duration, speed);
+    else
+      print_stats(journal, path);
+  } catch (po::error& e) {
+    std::cerr << "Bad options: " << e.what() << "\n";
+    std::cerr << "See " << argv[0] << " -h for help.\n";
+    return 1;
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,217 @@
+// Front door for several bomberperson servers on one machine.
+
+// The router owns the public port. Every client who connects is handed over
+// to one of the local robots-server workers (run with --handoff-socket) over
+// a Unix socket, the connection itself going along (see handoff.h). From then
+// on the client talks to the worker directly, the router only ever accepts.
+//
+// Those who come together should play together, so of the workers whose
+// lobbies want more clients the one wanting the fewest (closest to starting a
+// game) gets them. Only when no lobby wants anybody the worker with the most
+// free places does.
+//
+// Clients are handed over as soon as they connect rather than after their
+// first Join, as the server speaks first (Hello) and clients wait for it.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/program_options.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "handoff.h"
+#include "dbg.h"
+
+namespace po = boost::program_options;
+
+using boost::asio::ip::tcp;
+
+namespace local = boost::asio::local;
+
+namespace
+{
+
+class RoboticRouter {
+  boost::asio::io_context io_ctx;
+  tcp::acceptor acceptor;
+
+  // Handoff sockets of the workers and connections to them, closed when a
+  // worker is lost and connected again when it is next asked.
+  std::vector<std::pair<std::string, local::stream_protocol::socket>> workers;
+public:
+  RoboticRouter(uint16_t port, const std::vector<std::string>& paths)
+    : acceptor{io_ctx, tcp::endpoint{tcp::v6(), port}}
+  {
+    for (const std::string& path : paths)
+      workers.emplace_back(path, local::stream_protocol::socket{io_ctx});
+
+    dbg("Routing clients from port ", port, " to ", workers.size(), " workers.");
+  }
+
+  // Accept and hand over clients, forever.
+  void run();
+
+private:
+  // Load of worker w, no places if they cannot be reached.
+  WorkerLoad load(size_t w);
+
+  // The worker to hand the next client to, if anybody has got a place.
+  std::optional<size_t> pick();
+
+  // Whether worker w has got the client.
+  bool hand_over(size_t w, tcp::socket& client);
+
+  void lose(size_t w, const std::string& why);
+};
+
+WorkerLoad RoboticRouter::load(size_t w)
+{
+  auto& [path, sock] = workers.at(w);
+  if (!sock.is_open()) {
+    boost::system::error_code ec;
+    sock.connect(local::stream_protocol::endpoint{path}, ec);
+    if (ec) {
+      sock.close(ec);
+      return {0, 0};
+    }
+    dbg("[router] Connected to the worker at ", path);
+  }
+
+  try {
+    send_handoff(sock.native_handle(), HandoffOp::load);
+    return receive_load(sock.native_handle());
+  } catch (HandoffError& e) {
+    lose(w, e.what());
+    return {0, 0};
+  }
+}
+
+std::optional<size_t> RoboticRouter::pick()
+{
+  std::optional<size_t> lobby;
+  uint32_t fewest = 0;
+  std::optional<size_t> roomiest;
+  uint32_t most = 0;
+  for (size_t w = 0; w < workers.size(); ++w) {
+    auto [places, wanted] = load(w);
+    if (places == 0)
+      continue;
+
+    if (wanted > 0 && (!lobby.has_value() || wanted < fewest)) {
+      lobby = w;
+      fewest = wanted;
+    }
+    if (places > most) {
+      roomiest = w;
+      most = places;
+    }
+  }
+
+  return lobby.has_value() ? lobby : roomiest;
+}
+
+bool RoboticRouter::hand_over(size_t w, tcp::socket& client)
+{
+  auto& [path, sock] = workers.at(w);
+  try {
+    send_handoff(sock.native_handle(), HandoffOp::client, client.native_handle());
+    auto [places, wanted] = receive_load(sock.native_handle());
+    dbg("[router] Handed a client over to ", path, ", ", places, " places left there.");
+    return true;
+  } catch (HandoffError& e) {
+    lose(w, e.what());
+    return false;
+  }
+}
+
+void RoboticRouter::lose(size_t w, const std::string& why)
+{
+  auto& [path, sock] = workers.at(w);
+  log_warn("[router] Lost the worker at ", path, ": ", why);
+  boost::system::error_code ec;
+  sock.close(ec);
+}
+
+void RoboticRouter::run()
+{
+  for (;;) {
+    tcp::socket client{io_ctx};
+    boost::system::error_code ec;
+    acceptor.accept(client, ec);
+    if (ec) {
+      dbg("[router] Failed to accept: ", ec.message());
+      continue;
+    }
+    // The option stays with the connection when handed over.
+    client.set_option(tcp::no_delay{true}, ec);
+
+    // Any worker lost on the way is not picked again.
+    bool handed = false;
+    for (size_t tries = 0; !handed && tries < workers.size(); ++tries) {
+      std::optional<size_t> w = pick();
+      if (!w.has_value())
+        break;
+
+      handed = hand_over(*w, client);
+    }
+
+    if (!handed)
+      log_warn("[router] No worker has got a place for the client, good bye.");
+    // Either way this copy of the connection goes.
+  }
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    uint16_t port;
+    std::vector<std::string> worker_paths;
+    std::string log_level;
+
+    po::options_description desc{"Allowed flags for the router"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("port,p", po::value<uint16_t>(&port)->required(), "listen on port")
+      ("worker,w", po::value<std::vector<std::string>>(&worker_paths)->required(),
+       "handoff socket of a robots-server worker (--handoff-socket), repeated for each")
+      ("log-level", po::value<std::string>(&log_level)->default_value(debug ? "debug" : "info"),
+       "log level: debug, info, warn, error or off")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).
+              options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "\t\tBOMBERPERSON\n";
+      std::cout << "Usage: " << argv[0] <<  " -p port -w worker... [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    set_log_level(log_level_from_name(log_level));
+
+    RoboticRouter router{port, worker_paths};
+    router.run();
+  } catch (po::required_option& e) {
+    std::cerr << "Missing some options: " << e.what() << "\n";
+    std::cerr << "See " << argv[0] << " -h for help.\n";
+    return 1;
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
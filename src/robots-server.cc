@@ -1,16 +1,27 @@
 // Server for the bomberperson game.
 
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/program_options.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <bit>
+#include <cerrno>
 #include <condition_variable>
+#include <csignal>
+#include <filesystem>
+#include <cstring>
 #include <chrono>
-#include <deque>
 #include <limits>
-#include <random>
 #include <map>
 #include <set>
 #include <sstream>
@@ -28,18 +39,40 @@
 #include <utility>
 #include <variant>
 #include <optional>
+#include <span>
 #include <vector>
+#include <array>
+#include <memory>
 
+#include "alloc-hook.h"
 #include "readers.h"
 #include "marshal.h"
 #include "messages.h"
+#include "mailbox.h"
+#include "queue.h"
+#include "rate-limit.h"
+#include "engine.h"
+#include "handoff.h"
+#include "journal.h"
+#include "feed.h"
+#include "spectators.h"
+#include "checkpoint.h"
+#include "metrics.h"
+#include "lock-profile.h"
+#include "tcp-info.h"
+#include "uring.h"
+#include "trace.h"
 #include "dbg.h"
 
 namespace po = boost::program_options;
 
 using boost::asio::ip::tcp;
 
+namespace generic = boost::asio::generic;
+namespace local = boost::asio::local;
+
 using std::chrono::system_clock;
+using std::chrono::steady_clock;
 
 using input_messages::InputMessage;
 using display_messages::DisplayMessage;
@@ -51,8 +84,48 @@ namespace
 
 constexpr size_t MAX_CLIENTS = 25;
 
-// Helper for std::visiting mimicking pattern matching, inspired by cppref.
-template<typename> inline constexpr bool always_false_v = false;
+// Trace lanes: one per client slot and then this one for per-turn stages.
+constexpr uint32_t TURN_LANE = MAX_CLIENTS;
+
+// Most messages sent to clients at once: GameStarted, Turn and GameEnded when
+// a game lasts a single turn.
+constexpr size_t MAX_OUTGOING = 3;
+
+// Joins wait here for join_handler, at most one of every client (see
+// RoboticServer::join_pending) so that Join spam cannot fill it up.
+constexpr size_t JOIN_QUEUE_CAPACITY = std::bit_ceil(MAX_CLIENTS);
+
+// Default limits of input from a single client (see rate-limit.h), none.
+constexpr double INPUT_MESSAGES_PER_SEC = 0;
+constexpr double INPUT_BYTES_PER_SEC = 0;
+
+// Default size of the feed's ring, a good few seconds of turns of a busy game.
+constexpr size_t FEED_SIZE = 4 << 20;
+
+// Default number of turns spectators get at once (see spectators.h).
+constexpr size_t SPECTATOR_BATCH = 5;
+
+// Default flushes of spectators' batches a second, none but every batch.
+constexpr double SPECTATOR_RATE = 0;
+
+// Default number of turns between checkpoints (see checkpoint.h).
+constexpr uint16_t CHECKPOINT_EVERY = 10;
+
+// The io_uring backend (see RoboticServer::uring_loop): size of the rings and
+// of the buffers client input is received into.
+constexpr uint32_t URING_ENTRIES = 64;
+constexpr uint16_t RECV_GROUP = 0;
+constexpr uint16_t RECV_BUFFERS = 64;
+constexpr size_t RECV_BUFFER_SIZE = 4096;
+
+// What a completion of uring_loop is about, in the upper half of its user
+// data, the client's place being in the lower one.
+enum class UringOp : uint64_t { accept, recv, hail, resume };
+
+uint64_t uring_data(UringOp op, size_t i)
+{
+  return static_cast<uint64_t>(op) << 32 | i;
+}
 
 class ServerError : public std::runtime_error {
 public:
@@ -66,50 +139,136 @@ public:
   ServerLogicError(const std::string& msg) : std::logic_error{msg} {}
 };
 
+// Serialised messages shared (and never modified) by whoever sends them.
+using SharedBytes = std::shared_ptr<const std::vector<uint8_t>>;
 
-// https://stackoverflow.com/a/12805690/9058764
-template <typename T>
-class BlockingQueue {
-private:
-  std::mutex mutex;
-  std::condition_variable cv;
-  std::deque<T> queue;
-public:
-  void push(T const& value)
-  {
-    {
-      std::lock_guard<std::mutex> lock{mutex};
-      queue.push_front(value);
-    }
-    cv.notify_one();
-  }
+// A message to be broadcast and its version (see RoboticServer::HailSnapshot).
+using Outgoing = std::pair<const std::vector<uint8_t>*, uint64_t>;
 
-  T pop()
-  {
-    std::unique_lock<std::mutex> lock{mutex};
-    cv.wait(lock, [this] { return !queue.empty(); });
-    T elem{std::move(queue.back())};
-    queue.pop_back();
-    return elem;
-  }
-};
+SharedBytes share_bytes(Serialiser& ser)
+{
+  return std::make_shared<const std::vector<uint8_t>>(ser.drain_bytes());
+}
+
+// Size of a client's message on the wire, for the limit of bytes.
+size_t wire_size(const ClientMessage& msg)
+{
+  using namespace client_messages;
+  if (const Join* join = std::get_if<Join>(&msg))
+    return 2 + join->size();
+
+  return std::holds_alternative<Move>(msg) ? 2 : 1;
+}
 
 // This structure holds relevant information for a single connected client.
+// Note: the client's current move lives in RoboticServer::mailboxes instead.
 struct ConnectedClient {
-  tcp::socket sock;
+  // Connected over TCP or the Unix socket, all the same to the protocol.
+  generic::stream_protocol::socket sock;
   bool in_game = false;
-  std::optional<ClientMessage> current_move;
   uint8_t id;
+  // Version of the snapshot the client was hailed with (see HailSnapshot),
+  // it has got all broadcasts up to it that way.
+  uint64_t version = 0;
+  // While the snapshot is being sent, newer broadcasts wait here.
+  bool hailing = false;
+  std::vector<uint8_t> backlog;
 };
 
-// Get clients address in textual form (ip:port) from a tcp socket.
-std::string address_from_sock(const tcp::socket& sock)
+// SO_REUSEPORT, which asio has no name for.
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// A socket listening on the endpoint, if shared then one of many that the
+// kernel spreads incoming connections across.
+tcp::acceptor listen_on(boost::asio::io_context& io_ctx, const tcp::endpoint& endpoint,
+                        bool shared)
+{
+  tcp::acceptor acceptor{io_ctx};
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(tcp::acceptor::reuse_address{true});
+  if (shared)
+    acceptor.set_option(reuse_port{true});
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  return acceptor;
+}
+
+// CPUs the process may run on (as limited by taskset, cgroups...).
+cpu_set_t allowed_cpus()
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+    log_warn("Cannot get the allowed CPUs: ", std::strerror(errno));
+    for (unsigned cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); ++cpu)
+      CPU_SET(cpu, &set);
+  }
+
+  return set;
+}
+
+// Let the calling thread run on these CPUs.
+void set_affinity(const cpu_set_t& set)
+{
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0)
+    log_warn("Failed to set the CPU affinity: ", std::strerror(err));
+}
+
+// Keep the calling thread on the n-th of the allowed CPUs (wrapping around).
+void pin_to_cpu(const cpu_set_t& allowed, size_t n)
 {
+  size_t count = static_cast<size_t>(std::max(CPU_COUNT(&allowed), 1));
+  n %= count;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+
+    if (n-- == 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      set_affinity(set);
+      return;
+    }
+  }
+}
+
+// Get clients address in textual form (ip:port) from a socket. Those on the
+// Unix socket have no name, their pid stands in for it (unix:pid).
+std::string address_from_sock(generic::stream_protocol::socket& sock)
+{
+  boost::system::error_code ec;
+  generic::stream_protocol::endpoint remote = sock.remote_endpoint(ec);
+  // Gone already (happens when many reconnect at once), which the first
+  // read or write finds out.
+  if (ec)
+    return "(disconnected)";
+
+  if (remote.protocol().family() == AF_UNIX) {
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sock.native_handle(), SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+      return "unix:?";
+
+    return "unix:" + std::to_string(cred.pid);
+  }
+
+  tcp::endpoint tcp_remote;
+  std::memcpy(tcp_remote.data(), remote.data(), remote.size());
+  tcp_remote.resize(remote.size());
   std::stringstream s;
-  s << sock.remote_endpoint();
+  s << tcp_remote;
   return s.str();
 }
 
+// Address as above without the port (or pid), all Unix socket clients share
+// the host "unix".
+std::string host_of(const std::string& addr)
+{
+  return addr.substr(0, addr.rfind(':'));
+}
+
 // Utility function for finding a free id in a map with integral keys.
 template <std::integral K, typename V>
 K get_free_id(const std::map<K, V>& m)
@@ -125,19 +284,23 @@ K get_free_id(const std::map<K, V>& m)
 class RoboticServer {
   // Basic server parameters that should be known at all times.
   std::string name;
-  const uint16_t timer;
   const uint8_t players_count;
   const uint64_t turn_duration;
-  const uint16_t radius;
-  const uint16_t initial_blocks;
   const uint16_t game_len;
-  const uint16_t size_x;
-  const uint16_t size_y;
 
   // Networking.
   boost::asio::io_context io_ctx;
   tcp::endpoint endpoint;
-  tcp::acceptor tcp_acceptor;
+  // One listening socket, or more sharing the port (SO_REUSEPORT) each with
+  // an acceptor of its own.
+  std::vector<tcp::acceptor> tcp_acceptors;
+  // CPUs the process may use. Acceptors are pinned to one each, but client
+  // handlers they start must not stay on it.
+  cpu_set_t cpus = allowed_cpus();
+  // Optionally also a Unix socket for clients on this very machine.
+  std::optional<local::stream_protocol::acceptor> unix_acceptor;
+  // And one where robots-router hands clients over (see handoff.h).
+  std::optional<local::stream_protocol::acceptor> handoff_acceptor;
   
   // Game handling data.
 
@@ -148,22 +311,160 @@ class RoboticServer {
   // https://stackoverflow.com/a/49637243/9058764
 
   // Mutex to guard each connected client.
-  std::vector<std::mutex> clients_mutices = std::vector<std::mutex>(MAX_CLIENTS);
+  std::vector<ProfiledMutex> clients_mutices = std::vector<ProfiledMutex>(MAX_CLIENTS);
+
+  // Times each place has been taken, guarded by clients_mutices. A write
+  // resumed after its client has left must not go to whoever came next.
+  std::array<uint64_t, MAX_CLIENTS> places_taken{};
+
+  // Latest move of each connected client, indexed same as clients. These are
+  // written and swapped out without taking clients_mutices.
+  std::array<MoveMailbox, MAX_CLIENTS> mailboxes;
 
   // Count of currently connected clients ie. non "none" slots in clients.
   std::atomic_size_t number_of_clients = 0;
 
-  // Queue for all join requests.
-  BlockingQueue<std::pair<size_t, server_messages::Player>> joined;
+  // Queue for all join requests, many client handlers push, join_handler pops.
+  // Whether a client has got a Join there already, those who keep sending
+  // them have the rest dropped until join_handler gets to the first.
+  MpscQueue<std::pair<size_t, server_messages::Player>, JOIN_QUEUE_CAPACITY> joined;
+  std::array<std::atomic_bool, MAX_CLIENTS> join_pending{};
+
+  // Limits of input from a single client, messages and bytes per second.
+  double input_messages = INPUT_MESSAGES_PER_SEC;
+  double input_bytes = INPUT_BYTES_PER_SEC;
 
   // The "Hello" message sent by our server does not change throughout its work.
   const server_messages::Hello hello;
-
-  // Save all turns here as they happen to send them to late clients.
+  const SharedBytes hello_bytes;
+
+  // What a client connecting right now is told after Hello: AcceptedPlayer
+  // for each player in the lobby, or GameStarted once the game is on (and
+  // then the turns so far, from turns_ser). Snapshots are replaced, never
+  // modified, by join_handler and game_master, who thus never wait for
+  // anybody being hailed.
+  //
+  // Versions count the messages broadcast. Every message gets the next one
+  // and is put in the snapshot (or in the history of turns) before it is
+  // broadcast. A client hailed with version v is only sent newer messages.
+  struct HailSnapshot {
+    uint64_t version;
+    // Games started so far, telling whose turns are in turns_ser.
+    uint64_t game;
+    bool lobby;
+    SharedBytes handshake;
+  };
+
+  std::atomic<std::shared_ptr<const HailSnapshot>> hail_snapshot;
+  std::atomic_uint64_t broadcasts = 0;
+
+  // Optional io_uring backend, asio (ie. blocking calls) otherwise. The first
+  // ring serves uring_loop, the second one game_master who broadcasts turns
+  // from staging, a buffer registered with it.
+  std::unique_ptr<IoUring> recv_ring;
+  std::unique_ptr<IoUring> send_ring;
+  std::unique_ptr<uint8_t[]> staging;
+  size_t staging_size = 0;
+
+  // A client as seen by uring_loop, indexed same as clients: the input that
+  // has not made a whole message yet and what is being sent while hailing
+  // (the parts and how much of them has gone).
+  struct UringClient {
+    std::string addr;
+    std::vector<uint8_t> input;
+    std::shared_ptr<const HailSnapshot> snap;
+    std::vector<uint8_t> outgoing;
+    std::array<std::span<const uint8_t>, 3> parts;
+    size_t sent = 0;
+    std::array<iovec, 3> iov;
+    msghdr msg;
+    std::optional<InputLimiter> limiter;
+    // Over the limits: receiving is stopped until resume_after has passed.
+    bool throttled = false;
+    __kernel_timespec resume_after{};
+    bool receiving = false;
+    bool sending = false;
+    // Said something malformed and is being shut down.
+    bool closing = false;
+  };
+
+  std::array<UringClient, MAX_CLIENTS> uring_clients;
+
+  // Save all turns here as they happen to send them to late clients, along
+  // with the game they are of and the version of the latest.
   Serialiser turns_ser;
+  uint64_t turns_game = 0;
+  uint64_t turns_version = 0;
+
+  // The current turn encoded as the engine plays it, appended to the history
+  // and broadcast as it is. Only touched by game_master.
+  TurnEncoder turn_encoder;
+
+  // Messages game_master sends at the end of a turn, all in a single write
+  // to each client: GameStarted goes with turn 0 and GameEnded with the last.
+  std::vector<Outgoing> outbox;
+  Serialiser game_ended_ser;
+
+  // Optionally every game also goes to the disk.
+  std::unique_ptr<JournalWriter> journal;
+
+  // And to local observers through shared memory (see feed.h).
+  std::unique_ptr<FeedWriter> feed;
+
+  // And to spectators, by a thread of their own (see spectators.h).
+  std::unique_ptr<SpectatorHub> spectators;
+
+  // Optionally the game in progress is checkpointed every checkpoint_every
+  // turns (see checkpoint.h). Only touched by game_master, who remembers how
+  // much of turns_ser has been handed over.
+  std::unique_ptr<CheckpointWriter> checkpoints;
+  uint16_t checkpoint_every = CHECKPOINT_EVERY;
+  size_t checkpointed = 0;
+  Serialiser checkpoint_ser;
+
+  // A game resumed from a checkpoint goes on from this turn. Its players
+  // take their places back by joining under the same names.
+  uint16_t resume_turn = 0;
+  std::atomic_bool resumed = false;
+  // Turns it has had so far, each with where it ends in turns_ser, for
+  // game_master to record once more (see record_resumed).
+  std::vector<std::pair<uint16_t, size_t>> resumed_turns;
+
+  // Runtime metrics (see metrics.h) and ids of those updated as we go.
+  Metrics metrics;
+  Metrics::Id turn_time;
+  Metrics::Id broadcast_time;
+  Metrics::Id messages_sent;
+  Metrics::Id send_calls;
+  Metrics::Id bytes_sent;
+  Metrics::Id send_failures;
+  Metrics::Id hail_bytes;
+  Metrics::Id turn_allocations;
+  Metrics::Id dropped_messages;
+  Metrics::Id dropped_bytes;
+  Metrics::Id dropped_joins;
+  Metrics::Id collapsed_moves;
+  Metrics::Id feed_skipped;
+  Metrics::Id checkpoint_time;
+  std::optional<std::string> metrics_socket;
+
+  // Optional latency tracing (see trace.h). When tracing we also note when
+  // the latest move of each client came in and who moved in a traced turn.
+  Tracer tracer;
+  std::optional<std::string> trace_file;
+  std::array<std::atomic_int64_t, MAX_CLIENTS> posted_at{};
+  std::vector<std::pair<size_t, int64_t>> traced_moves;
+
+  // Whether heap allocations in turns after the first game are fatal.
+  bool check_allocs = false;
+  uint64_t games_played = 0;
 
   // For synchronisation.
 
+  // Stats of the locks below when they are profiled (see lock-profile.h).
+  // Those waited on with condition variables stay plain std::mutex.
+  std::unique_ptr<LockProfiler> lock_profiler;
+
   // For "acceptor" thread to wait for free spaces in clients vector for clients.
   std::mutex acceptor_mutex;
   std::condition_variable for_places;
@@ -175,47 +476,145 @@ class RoboticServer {
   // Protection of variables.
 
   // We want to access players_mutex in a read-write manner.
-  std::shared_mutex players_mutex;
+  ProfiledSharedMutex players_mutex;
 
   // Same with the serialiser that holds all turns.
-  std::shared_mutex turns_mutex;
+  ProfiledSharedMutex turns_mutex;
 
-  // When it comes to haling we also want to be sure we are doing this sharedly.
-  // todo: inspect this carefully pleeease
-  std::shared_mutex hail_mutex;
+  ProfiledMutex playing_clients_mutex;
 
-  std::mutex playing_clients_mutex;
+  // The rules of the game proper, driven by game_master.
+  GameEngine engine;
 
-  // Random number generator used by the server.
-  std::minstd_rand rand;
+  // Moves gathered from playing clients for the current turn.
+  Actions actions;
 
-  // Current game state:
+  // Current game state (the board itself is held by the engine):
   std::map<PlayerId, server_messages::Player> players;
-  std::set<PlayerId> killed_this_turn;
   std::map<PlayerId, size_t> playing_clients;
-  std::map<PlayerId, Position> positions;
-  std::map<BombId, server_messages::Bomb> bombs;
-  std::map<PlayerId, Score> scores;
-  std::set<Position> blocks;
-  std::set<Position> destroyed_this_turn;
-  std::vector<BombId> explosions;
 
   // This indicates whether we are currently in lobby state or not.
-  bool lobby = true;
+  std::atomic_bool lobby = true;
 public:
   RoboticServer(const std::string& name, uint16_t timer, uint8_t players_count,
                 uint64_t turn_duration, uint16_t radius, uint16_t initial_blocks,
                 uint16_t game_len, uint32_t seed, uint16_t size_x, uint16_t size_y,
-                uint16_t port)
-    : name{name}, timer{timer}, players_count{players_count}, turn_duration{turn_duration},
-      radius{radius}, initial_blocks{initial_blocks}, game_len{game_len}, size_x{size_x},
-      size_y{size_y}, io_ctx{}, endpoint(tcp::v6(), port), tcp_acceptor{io_ctx, endpoint},
-      hello{name, players_count, size_x, size_y, game_len, radius, timer}, rand{seed}
+                uint16_t port, size_t acceptors, const std::optional<std::string>& unix_socket,
+                const std::optional<std::string>& journal_dir,
+                const std::optional<std::string>& metrics_socket)
+    : name{name}, players_count{players_count}, turn_duration{turn_duration},
+      game_len{game_len}, io_ctx{}, endpoint(tcp::v6(), port),
+      hello{name, players_count, size_x, size_y, game_len, radius, timer},
+      hello_bytes{[this] {
+        Serialiser ser;
+        ser << ServerMessage{hello};
+        return share_bytes(ser);
+      }()},
+      hail_snapshot{std::make_shared<const HailSnapshot>(
+        HailSnapshot{0, 0, true, std::make_shared<const std::vector<uint8_t>>()})},
+      metrics_socket{metrics_socket},
+      engine{GameRules{size_x, size_y, game_len, radius, timer, initial_blocks}, seed}
   {
     dbg("\t\tBOMBERPERSON");
     dbg("Running the server \"", name, "\" on ", endpoint);
+
+    for (size_t i = 0; i < acceptors; ++i)
+      tcp_acceptors.push_back(listen_on(io_ctx, endpoint, acceptors > 1));
+
+    if (unix_socket.has_value()) {
+      // A socket left behind by a previous run would make binding fail.
+      std::filesystem::remove(unix_socket.value());
+      unix_acceptor.emplace(io_ctx, local::stream_protocol::endpoint{unix_socket.value()});
+      dbg("Also listening on ", unix_socket.value());
+    }
+
+    if (journal_dir.has_value()) {
+      journal = std::make_unique<JournalWriter>(journal_dir.value(), *hello_bytes);
+      dbg("Journaling games to ", journal_dir.value());
+    }
+
+    register_metrics();
+    traced_moves.reserve(MAX_CLIENTS);
+    outbox.reserve(MAX_OUTGOING);
+  }
+
+  // Trace one in sample_every turns into a Chrome trace file, saved after
+  // every game. Call before run.
+  void trace_to(const std::string& file, uint32_t sample_every)
+  {
+    trace_file = file;
+    tracer.enable(sample_every);
+  }
+
+  // Publish every game to the shared memory object name, keeping the last
+  // capacity bytes of messages there. Call before run.
+  void feed_to(const std::string& name, size_t capacity)
+  {
+    feed = std::make_unique<FeedWriter>(name, capacity, *hello_bytes);
+    dbg("Publishing games to the feed ", name);
+  }
+
+  // Serve spectators on port, sending them turns every batch_turns turns or
+  // rate times a second, whichever comes first. Call before run.
+  void spectate_on(uint16_t port, size_t batch_turns, double rate)
+  {
+    spectators = std::make_unique<SpectatorHub>(*hello_bytes, port, batch_turns, rate);
+    dbg("Serving spectators on port ", port, ", every ", batch_turns, " turns or ",
+        rate, " times a second.");
+  }
+
+  // Checkpoint the game in progress into dir every so many turns. If resume,
+  // the game of the latest checkpoint there (if any) is carried on with,
+  // otherwise whatever is there is forgotten. Call before run.
+  void checkpoint_to(const std::string& dir, uint16_t every, bool resume);
+
+  // Count acquisitions of the server's locks and time waiting for them
+  // and holding them, served with the metrics and reported on exit. Call
+  // before run.
+  void profile_locks()
+  {
+    lock_profiler = std::make_unique<LockProfiler>();
+    LockStats& clients_stats = lock_profiler->named("clients");
+    for (ProfiledMutex& mutex : clients_mutices)
+      mutex.profile(clients_stats);
+    playing_clients_mutex.profile(lock_profiler->named("playing_clients"));
+    players_mutex.profile(lock_profiler->named("players"));
+    turns_mutex.profile(lock_profiler->named("turns"));
+
+    metrics.collector([this] { return lock_profiler->render(); });
+    dbg("Profiling locks.");
   }
 
+  // Make heap allocations on the turn path (once the first game has warmed
+  // up all the buffers) a fatal error, to catch those who introduce them.
+  void check_allocations()
+  {
+    check_allocs = true;
+  }
+
+  // Let a client send at most this many messages and bytes a second, the
+  // rest of their input is dropped. Zero leaves that unlimited. Call before
+  // run.
+  void limit_input(double messages_per_sec, double bytes_per_sec)
+  {
+    input_messages = messages_per_sec;
+    input_bytes = bytes_per_sec;
+  }
+
+  // Take clients robots-router hands over on a Unix socket at path, besides
+  // those who connect. Call before run.
+  void accept_handoffs(const std::string& path)
+  {
+    // A socket left behind by a previous run would make binding fail.
+    std::filesystem::remove(path);
+    handoff_acceptor.emplace(io_ctx, local::stream_protocol::endpoint{path});
+    dbg("Taking clients handed over on ", path);
+  }
+
+  // Serve clients with io_uring instead of asio, throws UringError when the
+  // kernel cannot. Call before run.
+  void use_io_uring();
+
   void run();
 
 private:
@@ -223,7 +622,13 @@ private:
 
   // This thread handles incoming connections, accepts them (if there is enough
   // place on the server - see MAX_CLIENTS) and assigns a handling thread to them.
-  void acceptor();
+  // There is one for every listening socket, the Unix one included.
+  template <typename Protocol>
+  void acceptor(boost::asio::basic_socket_acceptor<Protocol>& listening);
+
+  // This one serves a router (one at a time): tells it the load and takes in
+  // the clients it hands over, as acceptor does.
+  void handoff_receiver();
 
   // This thread works in a loop and after each turn gathers input from playing
   // clients and then applies their moves when it is possible. Having done that
@@ -240,316 +645,805 @@ private:
   // This is the basic thread that hails and handles a single client (its input).
   void client_handler(ConnectedClient&& cl);
 
+  // With io_uring this single thread does what acceptor and all the
+  // client_handlers do otherwise: accepts, hails (with sends that do not
+  // block it) and receives from every client with a multishot receive each.
+  void uring_loop();
+
   // Helper and utility functions of all kinds.
 
-  // Find a place in the clients vector for this specific client.
-  size_t find_place(ConnectedClient&& cl);
+  // Register all metrics before any thread starts updating them.
+  void register_metrics();
 
-  // Sends all the necessary welcome info to a newly connected client.
-  void hail(tcp::socket& client);
+  // Find a place in the clients vector for this specific client, who has been
+  // given the snapshot of the given version. Nothing is placed if it has got
+  // out of date in the meantime.
+  std::optional<size_t> find_place(ConnectedClient& cl, uint64_t version);
 
-  // Starting and ending a game. Starting is creating the initial turn.
-  server_messages::Turn start_game();
-  void end_game();
+  // Put a newly connected client among the clients, returning their place
+  // and the snapshot they are to be hailed with (and the turns so far).
+  std::pair<size_t, std::shared_ptr<const HailSnapshot>>
+  take_place(ConnectedClient&& cl, std::vector<uint8_t>& turns_bytes);
 
-  // This function does all bombing related stuff (deaths, destruction, timers).
-  void do_bombing(server_messages::Turn& turn);
+  // Swap out what has been broadcast to a client while they were being
+  // hailed. If there is nothing they are hailed and false is returned.
+  bool take_backlog(size_t i, std::vector<uint8_t>& backlog);
 
-  // Simulate an explosion at given position spreading in chosen direction.
-  void explode_in_radius(std::set<PlayerId>& killed, std::set<Position>& destroyed,
-                        Position pos, client_messages::Direction dir);
+  // Sends all the necessary welcome info to a newly connected client and puts
+  // them among the clients, returning their place.
+  size_t hail(ConnectedClient&& cl);
 
-  // Find players at position pos and kill them.
-  void kill_on_position(std::set<PlayerId>& killed, Position pos);
+  // Replace the snapshot for hailing, returning its version.
+  uint64_t publish(bool lobby, uint64_t game, SharedBytes handshake);
 
-  // This gathers all moves from connected playing clients, processes them and
-  // adds to the current turn's event list.
-  void gather_moves(server_messages::Turn& turn);
+  // Starting and ending a game. Starting is encoding the initial turn. Ending
+  // is in two parts: before the last turn is sent GameEnded is serialised
+  // into game_ended_ser (its version returned) to go with it, after it the
+  // players go.
+  void start_game();
+  uint64_t prepare_game_end();
+  void end_game();
 
-  // Simulating a move in direction dir from position pos.
-  Position do_move(Position pos, client_messages::Direction dir) const;
+  // This gathers all moves from connected playing clients into actions so that
+  // the engine can apply them. If traced it also fills traced_moves.
+  void gather_moves(bool traced);
 
   // Utilities for sending.
 
-  // Send a message to all connected clients.
-  void send_to_all(const ServerMessage& msg);
-
-  // Wrapper for sending to a specific client socket, the second does not fail.
-  void send_bytes(const std::vector<uint8_t>& bytes, tcp::socket& sock);
-  bool try_send_bytes(const std::vector<uint8_t>& bytes, tcp::socket& sock);
+  // Send messages to all connected clients (those they have not got with
+  // their hail), with a single gathered write per client. Returns allocations
+  // made for those still being hailed, which are no fault of the turn sent.
+  void send_to_all(const ServerMessage& msg, uint64_t version);
+  uint64_t send_bytes_to_all(std::span<const Outgoing> messages);
+
+  // The same from game_master's ring: the messages are copied to staging and
+  // written from there, all the clients' writes submitted at once.
+  uint64_t uring_send_to_all(std::span<const Outgoing> messages);
+
+  // What a client said, be it a Join or a move.
+  void handle_message(size_t i, const std::string& addr, const ClientMessage& msg);
+
+  // Account for a message over the client's limits.
+  void drop_message(size_t i, size_t size);
+
+  // Give a player of a resumed game their place back (see resume_turn).
+  void reclaim(size_t i, const server_messages::Player& player);
+
+  // Take up the game in progress from a checkpoint.
+  void resume_game(const std::vector<uint8_t>& history, const std::vector<uint8_t>& state);
+
+  // Hand the state after the turn to the checkpoint writer when it is time.
+  // Given GameStarted when the game starts with the turn.
+  void checkpoint(uint16_t turn, const HailSnapshot* started);
+
+  // Forget a client who has gone away.
+  void disconnect(size_t i);
+
+  // Count a client in if there is a place for them (acceptors may race for
+  // the last one), or out, waking the acceptors up.
+  bool take_client_place();
+  void free_client_place();
+
+  // Start a client_handler of their own for a client given a place.
+  void spawn_client_handler(generic::stream_protocol::socket&& sock);
+
+  // A client's connection the router has handed over, whose place is taken
+  // here (or the connection closed if there is none).
+  void take_handoff(int fd);
+
+  // What the router is told (see handoff.h).
+  WorkerLoad worker_load() const;
+
+  // Parts of uring_loop: taking a client in, sending what is left of their
+  // hail (false if there is nothing), stopping to receive from a client over
+  // the limits for a while, handling the whole messages received and
+  // handling completions.
+  void uring_take(IoUring& ring, int fd, bool over_tcp);
+  bool uring_send_hail(IoUring& ring, size_t i);
+  void uring_hailed(IoUring& ring, size_t i, int res);
+  void uring_throttle(size_t i, size_t size);
+  void uring_decode(size_t i);
+  void uring_received(IoUring& ring, size_t i, const io_uring_cqe& cqe);
+  void uring_resume(IoUring& ring, size_t i);
+  void uring_drop(size_t i);
+
+  // Pass the serialised message on to the journal, the feed and the
+  // spectators (if any), none of which is waited for.
+  void record_bytes(JournalWriter::Kind kind, uint16_t turn, std::span<const uint8_t> bytes);
+
+  // Record the GameStarted and turns of a resumed game, its journal,
+  // spectators and feed readers are yet to see them.
+  void record_resumed();
+
+  // Account for heap allocations made by game_master during a turn, those
+  // handing it to the journal and spectators (recorded) apart: they depend on
+  // how far behind their threads are, so they are counted but never fatal.
+  void note_allocations(uint16_t turn, uint64_t allocs, uint64_t recorded);
+
+  // Wrapper for sending to a specific client socket.
+  void send_bytes(const std::vector<uint8_t>& bytes, generic::stream_protocol::socket& sock);
 };
 
 // Utility functions.
-void RoboticServer::hail(tcp::socket& client)
+void RoboticServer::register_metrics()
+{
+  turn_time = metrics.histogram("bomberperson_turn_seconds",
+                                "Time of processing a turn: gathering moves, "
+                                "stepping the game and saving the turn.");
+  broadcast_time = metrics.histogram("bomberperson_broadcast_seconds",
+                                     "Time of sending a turn to all clients.");
+  messages_sent = metrics.counter("bomberperson_messages_sent_total",
+                                  "Messages broadcast to a client slot.",
+                                  MAX_CLIENTS, "client");
+  send_calls = metrics.counter("bomberperson_send_calls_total",
+                               "Writes to client sockets made broadcasting, "
+                               "one per client per turn.");
+  bytes_sent = metrics.counter("bomberperson_bytes_sent_total",
+                               "Bytes broadcast to a client slot.", MAX_CLIENTS, "client");
+  send_failures = metrics.counter("bomberperson_send_failures_total",
+                                  "Failed broadcasts to a client slot.",
+                                  MAX_CLIENTS, "client");
+  hail_bytes = metrics.counter("bomberperson_hail_bytes_total",
+                               "Bytes sent to newly connected clients when hailing them.");
+  turn_allocations = metrics.counter("bomberperson_turn_allocations_total",
+                                     "Heap allocations made while playing turns.");
+  dropped_messages = metrics.counter("bomberperson_dropped_messages_total",
+                                     "Messages from a client slot over its rate limits.",
+                                     MAX_CLIENTS, "client");
+  dropped_bytes = metrics.counter("bomberperson_dropped_bytes_total",
+                                  "Bytes of messages from a client slot over its rate limits.",
+                                  MAX_CLIENTS, "client");
+  dropped_joins = metrics.counter("bomberperson_dropped_joins_total",
+                                  "Joins dropped as the client had one waiting already.");
+  collapsed_moves = metrics.counter("bomberperson_collapsed_moves_total",
+                                    "Moves overriding one not yet taken in the same turn.");
+  feed_skipped = metrics.counter("bomberperson_feed_skipped_total",
+                                 "Messages too big for the feed, left out of it.");
+  checkpoint_time = metrics.histogram("bomberperson_checkpoint_seconds",
+                                      "Time of handing a checkpoint over to its writer.");
+
+  metrics.gauge("bomberperson_connected_clients", "Currently connected clients.",
+                [this] { return static_cast<double>(number_of_clients.load()); });
+  metrics.gauge("bomberperson_playing_clients", "Clients playing in the current game.",
+                [this] {
+                  std::lock_guard lk{playing_clients_mutex};
+                  return static_cast<double>(playing_clients.size());
+                });
+  metrics.gauge("bomberperson_checkpoints_written", "Checkpoints that have reached the disk.",
+                [this] {
+                  return checkpoints ? static_cast<double>(checkpoints->checkpoints_written()) : 0.0;
+                });
+  metrics.gauge("bomberperson_checkpoints_failed", "Checkpoints that failed to be written.",
+                [this] {
+                  return checkpoints ? static_cast<double>(checkpoints->checkpoints_failed()) : 0.0;
+                });
+  metrics.gauge("bomberperson_spectators", "Currently connected spectators.",
+                [this] {
+                  return spectators ? static_cast<double>(spectators->spectators_count()) : 0.0;
+                });
+  metrics.gauge("bomberperson_dropped_spectators", "Spectators disconnected for lagging behind.",
+                [this] {
+                  return spectators ? static_cast<double>(spectators->dropped_spectators()) : 0.0;
+                });
+  metrics.gauge("bomberperson_join_queue_depth", "Join requests waiting to be handled.",
+                [this] { return static_cast<double>(joined.size()); });
+  metrics.gauge("bomberperson_turns_bytes", "Size of all turns of the current game.",
+                [this] {
+                  std::shared_lock read_lk{turns_mutex};
+                  return static_cast<double>(turns_ser.size());
+                });
+  metrics.gauge("bomberperson_tcp_segments_out", "TCP segments sent to connected clients.",
+                [this] {
+                  uint64_t segments = 0;
+                  for (size_t i = 0; i < clients.size(); ++i) {
+                    std::lock_guard lk{clients_mutices.at(i)};
+                    if (clients.at(i).has_value())
+                      segments += tcp_segments_out(clients.at(i)->sock.native_handle());
+                  }
+                  return static_cast<double>(segments);
+                });
+  metrics.counter("bomberperson_log_dropped_total", "Log lines dropped due to full rings.",
+                  [] { return static_cast<double>(log_dropped()); });
+}
+
+uint64_t RoboticServer::publish(bool lobby, uint64_t game, SharedBytes handshake)
+{
+  // Between these two hailing clients see their snapshot out of date and
+  // simply try again.
+  uint64_t version = broadcasts.fetch_add(1) + 1;
+  hail_snapshot.store(std::make_shared<const HailSnapshot>(
+    HailSnapshot{version, game, lobby, std::move(handshake)}));
+  return version;
+}
+
+std::pair<size_t, std::shared_ptr<const RoboticServer::HailSnapshot>>
+RoboticServer::take_place(ConnectedClient&& cl, std::vector<uint8_t>& turns_bytes)
+{
+  std::shared_ptr<const HailSnapshot> snap;
+  std::optional<size_t> place;
+  while (!place.has_value()) {
+    snap = hail_snapshot.load();
+    uint64_t version = snap->version;
+    turns_bytes.clear();
+    if (!snap->lobby) {
+      std::shared_lock read_lk{turns_mutex};
+      // The game may have not got to its first turn yet.
+      if (turns_game == snap->game) {
+        turns_bytes = turns_ser.to_bytes();
+        version = std::max(version, turns_version);
+      }
+    }
+
+    place = find_place(cl, version);
+    if (!place.has_value())
+      std::this_thread::yield();
+  }
+
+  return {place.value(), std::move(snap)};
+}
+
+bool RoboticServer::take_backlog(size_t i, std::vector<uint8_t>& backlog)
+{
+  backlog.clear();
+  std::lock_guard lk{clients_mutices.at(i)};
+  if (clients.at(i)->backlog.empty()) {
+    clients.at(i)->hailing = false;
+    return false;
+  }
+
+  std::swap(backlog, clients.at(i)->backlog);
+  return true;
+}
+
+size_t RoboticServer::hail(ConnectedClient&& cl)
 {
   dbg("[client_handler] Hailing a client.");
   const auto& [hname, hpc, hx, hy, hgl, hr, ht] = hello;
   dbg("[client_handler] Sending Hello{\"", hname, "\"", ", ", static_cast<int>(hpc),
       ", ", hx, ", ", hy, ", ", hgl, ", ", hr, ", ", ht, "}.");
-  Serialiser ser;
-  ser << ServerMessage{hello};
 
-  if (!lobby) {
-    dbg("[client_handler] Client late innit, sending GameStarted.");
-    server_messages::GameStarted gs;
-    {
-      std::shared_lock read_lk{players_mutex};
-      ser << ServerMessage{players};
-    }
-    send_bytes(ser.drain_bytes(), client);
-    std::vector<uint8_t> turns_bytes;
-    {
-      std::shared_lock read_lk{turns_mutex};
-      turns_bytes = turns_ser.to_bytes();
-    }
-    dbg("[client_handler] Sending all turns that have happened already, ",
-      turns_bytes.size(), " bytes.");
-    send_bytes(turns_bytes, client);
-  } else {
-    dbg("[client_handler] Sending players as a series of AcceptedPlayer messages.");
-    {
-      std::shared_lock read_lk{players_mutex};
-      for (const auto& [plid, player] : players) {
-        server_messages::AcceptedPlayer ap{plid, player};
-        ser << ServerMessage{ap};
-      }
+  std::vector<uint8_t> turns_bytes;
+  auto [i, snap] = take_place(std::move(cl), turns_bytes);
+
+  // Broadcasts to this client are held back from now on, the socket is ours.
+  generic::stream_protocol::socket& sock = clients.at(i)->sock;
+  try {
+    if (snap->lobby)
+      dbg("[client_handler] Sending players as a series of AcceptedPlayer messages.");
+    else
+      dbg("[client_handler] Client late innit, sending GameStarted and ",
+          turns_bytes.size(), " bytes of turns that have happened already.");
+
+    std::array<boost::asio::const_buffer, 3> hail{boost::asio::buffer(*hello_bytes),
+                                                  boost::asio::buffer(*snap->handshake),
+                                                  boost::asio::buffer(turns_bytes)};
+    boost::asio::write(sock, hail);
+    metrics.add(hail_bytes, hello_bytes->size() + snap->handshake->size() + turns_bytes.size());
+
+    // Catch up with what was broadcast in the meantime.
+    std::vector<uint8_t> backlog;
+    while (take_backlog(i, backlog)) {
+      send_bytes(backlog, sock);
+      metrics.add(hail_bytes, backlog.size());
     }
-    send_bytes(ser.drain_bytes(), client);
+  } catch (std::exception& e) {
+    std::lock_guard lk{clients_mutices.at(i)};
+    clients.at(i) = {};
+    throw;
   }
+
+  return i;
 }
 
-void RoboticServer::send_bytes(const std::vector<uint8_t>& bytes, tcp::socket& sock)
+void RoboticServer::send_bytes(const std::vector<uint8_t>& bytes,
+                               generic::stream_protocol::socket& sock)
 {
   sock.send(boost::asio::buffer(bytes));
 }
 
-bool RoboticServer::try_send_bytes(const std::vector<uint8_t>& bytes, tcp::socket& sock)
+void RoboticServer::record_bytes(JournalWriter::Kind kind, uint16_t turn,
+                                 std::span<const uint8_t> bytes)
 {
-  try {
-    send_bytes(bytes, sock);
-    return true;
-  } catch (std::exception& e) {
-    return false;
+  if (journal)
+    journal->record(kind, turn, bytes);
+  if (feed && !feed->publish(bytes))
+    metrics.add(feed_skipped, 1);
+  if (spectators) {
+    switch (kind) {
+    case JournalWriter::Kind::game_started:
+      spectators->publish(SpectatorHub::Kind::game_started, bytes);
+      break;
+    case JournalWriter::Kind::turn:
+      spectators->publish(SpectatorHub::Kind::turn, bytes);
+      break;
+    case JournalWriter::Kind::game_ended:
+      spectators->publish(SpectatorHub::Kind::game_ended, bytes);
+      break;
+    case JournalWriter::Kind::stop:
+      break;
+    }
   }
 }
 
-void RoboticServer::send_to_all(const ServerMessage& msg)
+void RoboticServer::note_allocations(uint16_t turn, uint64_t allocs, uint64_t recorded)
+{
+  if (recorded > 0)
+    metrics.add(turn_allocations, recorded);
+  if (allocs == 0)
+    return;
+
+  metrics.add(turn_allocations, allocs);
+  // The first game is the warm-up: buffers grow to the sizes turns need.
+  if (check_allocs && games_played > 0) {
+    log_error("[game_master] Turn ", turn, " made ", allocs, " heap allocations!");
+    throw ServerLogicError{"Heap allocation on the turn path!"};
+  }
+}
+
+void RoboticServer::send_to_all(const ServerMessage& msg, uint64_t version)
 {
   Serialiser ser;
   ser << msg;
+  std::array<Outgoing, 1> messages{Outgoing{&ser.to_bytes(), version}};
+  send_bytes_to_all(messages);
+}
+
+uint64_t RoboticServer::send_bytes_to_all(std::span<const Outgoing> messages)
+{
+  if (messages.size() > MAX_OUTGOING)
+    throw ServerLogicError{"Too many messages to send at once!"};
 
+  uint64_t allocs = 0;
+  std::array<boost::asio::const_buffer, MAX_OUTGOING> buffers;
   for (size_t i = 0; i < clients.size(); ++i) {
     std::optional<ConnectedClient>& cm = clients.at(i);
-    std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
-    if (cm.has_value())
-      try_send_bytes(ser.to_bytes(), cm->sock);
+    std::lock_guard lk{clients_mutices.at(i)};
+    if (!cm.has_value())
+      continue;
+
+    size_t count = 0;
+    size_t size = 0;
+    for (auto [bytes, version] : messages) {
+      if (version <= cm->version)
+        continue;
+
+      if (cm->hailing) {
+        uint64_t before = thread_allocations();
+        cm->backlog.insert(cm->backlog.end(), bytes->begin(), bytes->end());
+        allocs += thread_allocations() - before;
+      } else {
+        buffers[count++] = boost::asio::buffer(*bytes);
+        size += bytes->size();
+      }
+    }
+
+    if (count == 0)
+      continue;
+
+    // All in one sendmsg, so the messages share segments as if corked. Those
+    // who reset the connection (as throttled flooders do, leaving input
+    // unread) fail here without an exception, which would allocate.
+    boost::system::error_code ec;
+    boost::asio::write(cm->sock, std::span{buffers}.first(count), ec);
+    if (ec) {
+      metrics.add(send_failures, 1, i);
+    } else {
+      metrics.add(messages_sent, count, i);
+      metrics.add(bytes_sent, size, i);
+      metrics.add(send_calls);
+    }
   }
+
+  return allocs;
 }
 
-void RoboticServer::do_bombing(server_messages::Turn& turn)
+uint64_t RoboticServer::uring_send_to_all(std::span<const Outgoing> messages)
 {
-  auto& [_, events] = turn;
+  // Laid out oldest first: whatever a client is missing is a suffix.
+  std::array<size_t, MAX_OUTGOING + 1> offsets{};
+  for (size_t m = 0; m < messages.size(); ++m)
+    offsets[m + 1] = offsets[m] + messages[m].first->size();
+
+  size_t total = offsets[messages.size()];
+  if (total > staging_size) {
+    // Not on the way of turns once sized in use_io_uring for the worst one.
+    staging_size = std::bit_ceil(total);
+    staging = std::make_unique<uint8_t[]>(staging_size);
+    std::array<iovec, 1> buffers{iovec{staging.get(), staging_size}};
+    send_ring->register_buffers(buffers);
+  }
 
-  for (auto& [bombid, bomb] : bombs) {
-    auto& [bomb_pos, bomb_timer] = bomb;
-    --bomb_timer;
-    if (bomb_timer == 0) {
-      explosions.push_back(bombid);
-      std::set<PlayerId> killed;
-      std::set<Position> destroyed;
+  for (size_t m = 0; m < messages.size(); ++m)
+    std::memcpy(staging.get() + offsets[m], messages[m].first->data(), messages[m].first->size());
+
+  // Slots stay locked until their writes are submitted, the kernel holds on
+  // to the sockets themselves from then on. Whether the descriptor number is
+  // taken by somebody else afterwards does not matter.
+  uint64_t allocs = 0;
+  std::array<std::unique_lock<ProfiledMutex>, MAX_CLIENTS> locks;
+  // Offset written up to, the descriptor and the place's places_taken.
+  std::array<std::tuple<size_t, int, uint64_t>, MAX_CLIENTS> written;
+  size_t writing = 0;
+  for (size_t i = 0; i < clients.size(); ++i) {
+    std::unique_lock lk{clients_mutices.at(i)};
+    std::optional<ConnectedClient>& cm = clients.at(i);
+    if (!cm.has_value())
+      continue;
 
-      client_messages::Direction dirs[] = {client_messages::Up{},
-        client_messages::Down{}, client_messages::Left{}, client_messages::Right{}};
+    size_t first = 0;
+    while (first < messages.size() && messages[first].second <= cm->version)
+      ++first;
 
-      // Go in all directions and do the explosive bit of action.
-      for (client_messages::Direction d : dirs)
-        explode_in_radius(killed, destroyed, bomb_pos, d);
+    if (first == messages.size())
+      continue;
 
-      events.push_back(server_messages::BombExploded{bombid, killed, destroyed});
+    if (cm->hailing) {
+      uint64_t before = thread_allocations();
+      for (size_t m = first; m < messages.size(); ++m)
+        cm->backlog.insert(cm->backlog.end(), messages[m].first->begin(),
+                           messages[m].first->end());
+      allocs += thread_allocations() - before;
+      continue;
     }
+
+    int fd = cm->sock.native_handle();
+    prep_write_fixed(send_ring->sqe(), fd, {staging.get() + offsets[first], total - offsets[first]},
+                     0, i);
+    written[i] = {offsets[first], fd, places_taken.at(i)};
+    locks[i] = std::move(lk);
+    ++writing;
+    metrics.add(messages_sent, messages.size() - first, i);
+    metrics.add(bytes_sent, total - offsets[first], i);
+    metrics.add(send_calls);
+  }
+
+  // A client who does not read keeps nobody else waiting for their slot,
+  // neither game_master nor the receiving thread.
+  send_ring->submit();
+  for (std::unique_lock<ProfiledMutex>& lk : locks) {
+    if (lk.owns_lock())
+      lk.unlock();
+  }
+
+  // A socket may take less than it is given, the rest is written again if
+  // the client is still there.
+  while (writing > 0) {
+    send_ring->submit(static_cast<uint32_t>(writing));
+    send_ring->reap([&] (const io_uring_cqe& cqe) {
+      size_t i = static_cast<size_t>(cqe.user_data);
+      auto& [offset, fd, taken] = written[i];
+      if (cqe.res <= 0) {
+        metrics.add(send_failures, 1, i);
+        --writing;
+        return;
+      }
+
+      offset += static_cast<size_t>(cqe.res);
+      if (offset == total) {
+        --writing;
+        return;
+      }
+
+      std::lock_guard lk{clients_mutices.at(i)};
+      if (!clients.at(i).has_value() || places_taken.at(i) != taken) {
+        --writing;
+        return;
+      }
+
+      prep_write_fixed(send_ring->sqe(), fd, {staging.get() + offset, total - offset}, 0, i);
+      send_ring->submit();
+    });
   }
+
+  return allocs;
 }
 
-void RoboticServer::gather_moves(server_messages::Turn& turn)
+void RoboticServer::handle_message(size_t i, const std::string& addr, const ClientMessage& msg)
 {
-  std::lock_guard<std::mutex> lk{playing_clients_mutex};
-  for (const auto& [id, idx] : playing_clients) {
-    std::lock_guard<std::mutex> lk{clients_mutices.at(idx)};
-    std::optional<ConnectedClient>& maybe_cl = clients.at(idx);
-
-    if (!maybe_cl.has_value() || !maybe_cl->in_game)
-      throw ServerLogicError{"Clients in playing_clients should be in game!"};
+  using namespace client_messages;
+  std::visit([this, i, &addr] <typename Cm> (const Cm& cm) {
+      if constexpr (std::same_as<Cm, Join>) {
+        // Do this only when in lobby state (or to take a place back in a
+        // resumed game), do not bother join handler. Nor the client's mutex
+        // while their previous Join waits.
+        if (!lobby && !resumed)
+          return;
+
+        if (join_pending.at(i).exchange(true)) {
+          metrics.add(dropped_joins);
+          return;
+        }
 
-    std::string addr = address_from_sock(maybe_cl->sock);
-    if (!killed_this_turn.contains(id)) {
-      if (!maybe_cl->current_move.has_value()) {
-        dbg("[game_master] Playing client ", addr, " ie. player ",
-            static_cast<int>(id), " has not done anything.");
-        continue;
+        std::lock_guard lk{clients_mutices.at(i)};
+        if (clients.at(i)->in_game || !joined.try_push({i, {cm, addr}}))
+          join_pending.at(i) = false;
+      } else if (!lobby) {
+        // Stray moves in the lobby should not affect the upcoming game.
+        // No lock here, latest move wins and gather_moves swaps it out.
+        if (tracer.enabled())
+          posted_at.at(i).store(Tracer::now(), std::memory_order_relaxed);
+        if (mailboxes.at(i).post(cm))
+          metrics.add(collapsed_moves);
       }
+    }, msg);
+}
 
-      using namespace client_messages;
-      PlayerId plid = id;
-      const ClientMessage& cmsg = maybe_cl->current_move.value();
-
-      // Pattern match the player's action.
-      std::visit([this, &turn, plid, &addr] <typename Cm> (const Cm& cm) {
-          auto& [_, events] = turn;
-          if constexpr (std::same_as<Cm, Join>) {
-            throw ServerLogicError{"Join should not be placed as current move!"};
-          } else if constexpr (std::same_as<Cm, PlaceBomb>) {
-            dbg("[game_master] Playing client ", addr, " ie. player ",
-                static_cast<int>(plid), " has placed a bomb.");
-
-            // Get an id for the new bomb.
-            BombId bombid = get_free_id(bombs);
-            server_messages::Bomb bomb{positions.at(plid), timer};
-            bombs.insert({bombid, bomb});
-            server_messages::BombPlaced bp{bombid, bomb.first};
-            events.push_back(bp);
-          } else if constexpr (std::same_as<Cm, PlaceBlock>) {
-            dbg("[game_master] Playing client ", addr, " ie. player ",
-                static_cast<int>(plid), " has placed a block.");
-
-            Position pos = positions.at(plid);
-            blocks.insert(pos);
-            events.push_back(server_messages::BlockPlaced{pos});
-          } else if constexpr (std::same_as<Cm, Move>) {
-            dbg("[game_master] Playing client ", addr, " ie. player ",
-                static_cast<int>(plid), " wants to move.");
-
-            Position pos = positions.at(plid);
-            Position new_pos = do_move(pos, cm);
-            if (!blocks.contains(new_pos) && pos != new_pos) {
-              positions.at(plid) = new_pos;
-              server_messages::PlayerMoved pm{plid, new_pos};
-              events.push_back(pm);
-            }
-          } else {
-            static_assert(always_false_v<Cm>, "Non-exhaustive pattern matching!");
-          }
-        }, cmsg);
-    }
-
-    // We do not want this move to stay here before the next turn.
-    maybe_cl->current_move = {};
-  }
-}
-
-void RoboticServer::kill_on_position(std::set<PlayerId>& killed, Position pos)
-{
-  // Not super effective but MAX_CLIENTS is 25 so this is theoretically O(1).
-  for (const auto& [id, pl_pos] : positions)
-    if (pl_pos == pos) {
-      killed.insert(id);
-      killed_this_turn.insert(id);
-    }
-}
-
-void RoboticServer::explode_in_radius(std::set<PlayerId>& killed,
-                                      std::set<Position>& destroyed,
-                                      Position pos, client_messages::Direction dir)
-{
-  // Note: `<= radius` as the bomb position itself is also affected.
-  for (uint16_t i = 0; i <= radius; ++i) {
-    Position next = do_move(pos, dir);
-    kill_on_position(killed, pos);
-
-    if (blocks.contains(pos)) {
-      destroyed.insert(pos);
-      destroyed_this_turn.insert(pos);
-      return;
+void RoboticServer::drop_message(size_t i, size_t size)
+{
+  metrics.add(dropped_messages, 1, i);
+  metrics.add(dropped_bytes, size, i);
+}
+
+void RoboticServer::reclaim(size_t i, const server_messages::Player& player)
+{
+  // In the order of gather_moves, which runs meanwhile.
+  std::lock_guard play_lk{playing_clients_mutex};
+  std::lock_guard lk{clients_mutices.at(i)};
+  if (!clients.at(i).has_value() || clients.at(i)->in_game)
+    return;
+
+  // Players map does not change during the game. Names are anybody's to
+  // take, so the player has to come back from where they played too.
+  for (const auto& [id, saved] : players) {
+    if (saved.first != player.first || host_of(saved.second) != host_of(player.second)
+        || playing_clients.contains(id))
+      continue;
+
+    playing_clients[id] = i;
+    clients.at(i)->in_game = true;
+    clients.at(i)->id = id;
+    log_info("[join_handler] ", player.first, "@", player.second, " is back as player ",
+             static_cast<int>(id), ".");
+    return;
+  }
+}
+
+void RoboticServer::checkpoint_to(const std::string& dir, uint16_t every, bool resume)
+{
+  checkpoint_every = every;
+  std::optional<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> saved;
+  if (resume) {
+    auto start = steady_clock::now();
+    saved = load_checkpoint(dir, *hello_bytes);
+    if (saved.has_value()) {
+      resume_game(saved->first, saved->second);
+      log_info("Resumed the game at turn ", resume_turn - 1, " in ",
+               std::chrono::duration<double, std::milli>(steady_clock::now() - start).count(),
+               "ms.");
+    } else {
+      log_info("No game to resume in ", dir, ".");
     }
+  }
 
-    if (next == pos)
-      return;
+  // Only once the history has been cut to the checkpoint.
+  checkpoints = std::make_unique<CheckpointWriter>(dir, *hello_bytes);
+  if (!saved.has_value())
+    checkpoints->clear();
+  dbg("Checkpointing games to ", dir, " every ", every, " turns.");
+}
 
-    pos = next;
+void RoboticServer::resume_game(const std::vector<uint8_t>& history,
+                                const std::vector<uint8_t>& state)
+{
+  ServerMessage started;
+  size_t started_size;
+  std::tuple<uint16_t, std::map<PlayerId, server_messages::Player>, GameEngine::Snapshot> game;
+  try {
+    Deserialiser<ReaderMemory> history_deser{ReaderMemory{history.data(), history.size()}};
+    history_deser >> started;
+    started_size = history_deser.readable().position();
+    resumed_turns.clear();
+    while (history_deser.readable().position() < history.size()) {
+      ServerMessage msg;
+      history_deser >> msg;
+      if (!std::holds_alternative<server_messages::Turn>(msg))
+        throw CheckpointError{"The history has more than turns after GameStarted!"};
+      resumed_turns.emplace_back(std::get<server_messages::Turn>(msg).first,
+                                 history_deser.readable().position() - started_size);
+    }
+    Deserialiser<ReaderMemory> state_deser{ReaderMemory{state.data(), state.size()}};
+    state_deser >> game;
+    state_deser.no_trailing_bytes();
+  } catch (UnmarshallingError& e) {
+    throw CheckpointError{std::string{"Broken checkpoint: "} + e.what()};
   }
+
+  if (!std::holds_alternative<server_messages::GameStarted>(started))
+    throw CheckpointError{"The history does not start with GameStarted!"};
+
+  auto& [turn, saved_players, snapshot] = game;
+  players = saved_players;
+  engine.restore(snapshot);
+  turn_encoder.reserve(TurnEncoder::max_turn_bytes(players.size()));
+
+  // Hailed as when joining late, even before game_master gets going.
+  turns_ser.clear();
+  turns_ser.append(std::vector<uint8_t>(history.begin() + static_cast<ptrdiff_t>(started_size),
+                                        history.end()));
+  checkpointed = turns_ser.size();
+  Serialiser ser;
+  ser.append(std::vector<uint8_t>(history.begin(),
+                                  history.begin() + static_cast<ptrdiff_t>(started_size)));
+  publish(false, hail_snapshot.load()->game + 1, share_bytes(ser));
+  turns_game = hail_snapshot.load()->game;
+  turns_version = broadcasts.fetch_add(1) + 1;
+
+  lobby = false;
+  resumed = true;
+  resume_turn = turn + 1;
 }
 
-Position RoboticServer::do_move(Position pos, client_messages::Direction dir) const
+void RoboticServer::record_resumed()
 {
-  using namespace client_messages;
+  // The handshake of a resumed game is its GameStarted alone.
+  record_bytes(JournalWriter::Kind::game_started, 0, *hail_snapshot.load()->handshake);
+  std::span<const uint8_t> turns{turns_ser.to_bytes()};
+  size_t start = 0;
+  for (auto [turn, end] : resumed_turns) {
+    record_bytes(JournalWriter::Kind::turn, turn, turns.subspan(start, end - start));
+    start = end;
+  }
+  resumed_turns.clear();
+}
 
-  return std::visit([this, pos] <typename D> (D) {
-      auto [x, y] = pos;
-      if constexpr (std::same_as<D, Up>) {
-        return (y + 1 < size_y) ? Position{x, y + 1} : pos;
-      } else if constexpr (std::same_as<D, Down>) {
-        return (y > 0) ? Position{x, y - 1} : pos;
-      } else if constexpr (std::same_as<D, Left>) {
-        return (x > 0) ? Position{x - 1, y} : pos;
-      } else if constexpr (std::same_as<D, Right>) {
-        return (x + 1 < size_x) ? Position{x + 1, y} : pos;
-      } else {
-        static_assert(always_false_v<D>, "Non-exhaustive pattern matching!");
-      }
-    }, dir);
+void RoboticServer::checkpoint(uint16_t turn, const HailSnapshot* started)
+{
+  auto start = steady_clock::now();
+  if (started) {
+    checkpoints->start_game(*started->handshake);
+    checkpointed = 0;
+  }
+
+  if (turn % checkpoint_every != 0)
+    return;
+
+  checkpoint_ser.clear();
+  checkpoint_ser << turn << players;
+  engine.save(checkpoint_ser);
+  const std::vector<uint8_t>& turns = turns_ser.to_bytes();
+  checkpoints->save(std::span{turns}.subspan(checkpointed), checkpoint_ser.to_bytes());
+  checkpointed = turns.size();
+  metrics.observe(checkpoint_time, steady_clock::now() - start);
 }
 
-server_messages::Turn RoboticServer::start_game()
+void RoboticServer::disconnect(size_t i)
 {
-  dbg("[game_master] Starting the game, cleaning all data and composing turn 0.");
-  killed_this_turn = {};
-  positions = {};
-  bombs = {};
-  scores = {};
-  blocks = {};
-  explosions = {};
+  {
+    std::lock_guard lk{playing_clients_mutex};
+    playing_clients.erase(clients.at(i)->id);
+  }
+  {
+    std::lock_guard lk{clients_mutices.at(i)};
+    clients.at(i) = {};
+  }
+  free_client_place();
+}
 
-  server_messages::Turn turn{0, {}};
-  auto& [_turnno, events] = turn;
-  for (const auto& [id, _] : players) {
-    scores[id] = 0;
-    dbg("[game_master] Placing player ", static_cast<int>(id), " on the board.");
-    Position pos = {rand() % size_x, rand() % size_y};
-    positions[id] = pos;
-    events.push_back(server_messages::PlayerMoved{id, pos});
+bool RoboticServer::take_client_place()
+{
+  size_t n = number_of_clients.load();
+  while (n < MAX_CLIENTS) {
+    if (number_of_clients.compare_exchange_weak(n, n + 1))
+      return true;
   }
 
-  dbg("[game_master] Placing ", initial_blocks, " blocks on the board.");
-  for (uint16_t i = 0; i < initial_blocks; ++i) {
-    Position pos = {rand() % size_x, rand() % size_y};
-    blocks.insert(pos);
-    events.push_back(server_messages::BlockPlaced{pos});
+  return false;
+}
+
+void RoboticServer::free_client_place()
+{
+  --number_of_clients;
+  {
+    // Acceptors check for places under the mutex, this keeps them from
+    // missing the notification.
+    std::lock_guard lk{acceptor_mutex};
   }
+  for_places.notify_all();
+}
 
-  return turn;
+void RoboticServer::gather_moves(bool traced)
+{
+  actions.assign(actions.size(), std::nullopt);
+  traced_moves.clear();
+  std::lock_guard lk{playing_clients_mutex};
+  for (const auto& [id, idx] : playing_clients) {
+    // Swapping the move out also makes sure it does not stay here before the
+    // next turn, even if the player got killed in this one.
+    std::optional<InputMessage> move = mailboxes.at(idx).take();
+
+    if (!move.has_value()) {
+      // Players map does not change during the game and it holds the address.
+      dbg("[game_master] Playing client ", players.at(id).second, " ie. player ",
+          static_cast<int>(id), " has not done anything.");
+      continue;
+    }
+
+    if (traced)
+      traced_moves.emplace_back(idx, posted_at.at(idx).load(std::memory_order_relaxed));
+
+    if (id >= actions.size())
+      actions.resize(id + 1);
+
+    actions[id] = move;
+  }
 }
 
-void RoboticServer::end_game()
+void RoboticServer::start_game()
+{
+  dbg("[game_master] Starting the game.");
+  // Moves sent just before the previous game ended should not leak into this one.
+  for (MoveMailbox& mailbox : mailboxes)
+    mailbox.clear();
+
+  std::set<PlayerId> ids;
+  for (const auto& [id, _] : players)
+    ids.insert(id);
+
+  // Sized for the largest turn of the game so that turns do not grow it.
+  size_t blocks = engine.game_rules().initial_blocks;
+  turn_encoder.reserve(std::max(TurnEncoder::first_turn_bytes(ids.size(), blocks),
+                                TurnEncoder::max_turn_bytes(ids.size())));
+  turn_encoder.begin(0);
+  engine.start(ids, turn_encoder);
+}
+
+uint64_t RoboticServer::prepare_game_end()
 {
   std::cout << "GAME ENDED!!!\n";
+  std::map<PlayerId, Score> scores{engine.player_scores().begin(), engine.player_scores().end()};
+  engine.end();
   for (auto [id, score] : scores)
     std::cout << static_cast<int>(id) << "\t" << players.at(id).first
          << "@" << players.at(id).second << " got killed " << score << " times!\n";
 
-  send_to_all(ServerMessage{scores});
+  game_ended_ser.clear();
+  game_ended_ser << ServerMessage{scores};
+  // Those who connect from now on are in the next lobby.
+  return publish(true, hail_snapshot.load()->game, std::make_shared<const std::vector<uint8_t>>());
+}
+
+void RoboticServer::end_game()
+{
+  record_bytes(JournalWriter::Kind::game_ended, 0, game_ended_ser.to_bytes());
+  if (checkpoints)
+    checkpoints->clear();
+  resumed = false;
+  if (trace_file.has_value())
+    tracer.dump(trace_file.value(), "robots-server");
+  ++games_played;
   // Do not need a mutex for players as no thread will access it during game.
   players = {};
   {
     // I need a lock here though as client_handler may try to access this.
-    std::lock_guard<std::mutex> lk{playing_clients_mutex};
+    std::lock_guard lk{playing_clients_mutex};
     playing_clients = {};
   }
 
   for (size_t i = 0; i < clients.size(); ++i) {
-    std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
+    std::lock_guard lk{clients_mutices.at(i)};
     if (clients.at(i).has_value()) {
       clients.at(i)->in_game = false;
     }
   }
 }
 
-size_t RoboticServer::find_place(ConnectedClient&& cl)
+std::optional<size_t> RoboticServer::find_place(ConnectedClient& cl, uint64_t version)
 {
   for (size_t i = 0; i < clients.size(); ++i) {
-    std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
+    std::lock_guard lk{clients_mutices.at(i)};
     if (clients.at(i).has_value())
       continue;
 
+    // Something newer has been broadcast (maybe even to this place) already,
+    // otherwise whatever comes next will see this client here.
+    if (broadcasts.load() != version)
+      return {};
+
+    cl.version = version;
+    cl.hailing = true;
     clients.at(i) = std::move(cl);
+    ++places_taken.at(i);
+    mailboxes.at(i).clear();
     return i;
   }
 
@@ -557,7 +1451,8 @@ size_t RoboticServer::find_place(ConnectedClient&& cl)
 }
 
 // Thread functions.
-void RoboticServer::acceptor()
+template <typename Protocol>
+void RoboticServer::acceptor(boost::asio::basic_socket_acceptor<Protocol>& listening)
 {
   dbg("[acceptor] hello");
   for (;;) {
@@ -572,23 +1467,106 @@ void RoboticServer::acceptor()
       for_places.wait(lk, [this] {return number_of_clients < MAX_CLIENTS;});
     }
 
-    tcp::socket new_client{io_ctx};
-    tcp_acceptor.accept(new_client);
-    tcp::no_delay option(true);
-    new_client.set_option(option);
+    generic::stream_protocol::socket new_client{io_ctx};
+    listening.accept(new_client);
+    try {
+      // Unix sockets have no Nagle to turn off.
+      if constexpr (std::same_as<Protocol, tcp>) {
+        tcp::no_delay option(true);
+        new_client.set_option(option);
+      }
+      dbg("[acceptor] Accepted new client ", address_from_sock(new_client));
+    } catch (std::exception& e) {
+      // Gone already, as happens when many reconnect at once.
+      dbg("[acceptor] Lost a client as they came: ", e.what());
+      continue;
+    }
 
-    dbg("[acceptor] Accepted new client ", new_client.remote_endpoint());
+    {
+      // Another acceptor may have taken the last place in the meantime.
+      std::unique_lock lk{acceptor_mutex};
+      for_places.wait(lk, [this] { return take_client_place(); });
+    }
 
-    ConnectedClient cl{std::move(new_client), false, {}, 0};
-    ++number_of_clients;
-    std::jthread th{[this, cl=std::move(cl)] () mutable {
-      client_handler(std::move(cl));
-    }};
-    // We detach this thread as its execution is independent.
-    th.detach();
+    spawn_client_handler(std::move(new_client));
   }
 }
 
+void RoboticServer::spawn_client_handler(generic::stream_protocol::socket&& sock)
+{
+  ConnectedClient cl{std::move(sock), false, 0, 0, false, {}};
+  std::jthread th{[this, cl=std::move(cl)] () mutable {
+    // The thread got its acceptor's CPU, the handlers spread over all of them.
+    if (tcp_acceptors.size() > 1)
+      set_affinity(cpus);
+    client_handler(std::move(cl));
+  }};
+  // We detach this thread as its execution is independent.
+  th.detach();
+}
+
+void RoboticServer::handoff_receiver()
+{
+  dbg("[handoff] hello");
+  for (;;) {
+    local::stream_protocol::socket router{io_ctx};
+    handoff_acceptor->accept(router);
+    dbg("[handoff] A router has come.");
+    try {
+      for (;;) {
+        auto [op, fd] = receive_handoff(router.native_handle());
+        if (op == HandoffOp::client)
+          take_handoff(fd);
+
+        send_load(router.native_handle(), worker_load());
+      }
+    } catch (HandoffError& e) {
+      dbg("[handoff] The router has gone: ", e.what());
+    }
+  }
+}
+
+WorkerLoad RoboticServer::worker_load() const
+{
+  size_t connected = number_of_clients.load();
+  // Those in the lobby may not have joined yet, but they most likely will.
+  size_t wanted = lobby && connected < players_count ? players_count - connected : 0;
+  return {static_cast<uint32_t>(MAX_CLIENTS - connected), static_cast<uint32_t>(wanted)};
+}
+
+void RoboticServer::take_handoff(int fd)
+{
+  if (fd < 0) {
+    dbg("[handoff] A client came without their connection.");
+    return;
+  }
+
+  // Handed over are TCP connections of either family.
+  sockaddr_storage local_addr{};
+  socklen_t len = sizeof(local_addr);
+  generic::stream_protocol::socket sock{io_ctx};
+  try {
+    if (getsockname(fd, reinterpret_cast<sockaddr*>(&local_addr), &len) != 0)
+      throw ServerError{std::strerror(errno)};
+
+    sock.assign(generic::stream_protocol{local_addr.ss_family, IPPROTO_TCP}, fd);
+  } catch (std::exception& e) {
+    dbg("[handoff] Failed to take a client in: ", e.what());
+    close(fd);
+    return;
+  }
+
+  // The router picks those with places, yet someone may have connected here
+  // in the meantime.
+  if (!take_client_place()) {
+    dbg("[handoff] No place for the client handed over.");
+    return;
+  }
+
+  dbg("[handoff] Handed over client ", address_from_sock(sock));
+  spawn_client_handler(std::move(sock));
+}
+
 void RoboticServer::client_handler(ConnectedClient&& cl)
 {
   using namespace client_messages;
@@ -596,56 +1574,304 @@ void RoboticServer::client_handler(ConnectedClient&& cl)
   size_t i;
   dbg("[client_handler] Handling client ", addr);
 
-  {
-    std::shared_lock hail_lk{hail_mutex};
-    try {
-      hail(cl.sock);
-    } catch (std::exception& e) {
+  try {
+    i = hail(std::move(cl));
+  } catch (std::exception& e) {
     dbg("[client_handler] Failed to hail the client, good bye.");
-    --number_of_clients;
+    free_client_place();
     return;
-    }
-
-    i = find_place(std::move(cl));
-    dbg("[client_handler] Client ", addr, " added to the array of listening clients.");
   }
+  dbg("[client_handler] Client ", addr, " added to the array of listening clients.");
 
-  Deserialiser<ReaderTCP> deser{clients.at(i)->sock};
+  Deserialiser<ReaderStream> deser{clients.at(i)->sock};
+  InputLimiter limiter{input_messages, input_bytes};
   for (;;) {
     try {
       ClientMessage msg;
       deser >> msg;
-      {
-        std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
-        std::visit([this, i, &addr] <typename Cm> (const Cm& cm) {
-            if constexpr (std::same_as<Cm, Join>) {
-              if (!clients.at(i)->in_game && lobby) {
-                // Do this only when in lobby state, do not bother join handler.
-                joined.push({i, {cm, addr}});
-              }
-            } else if (!lobby) {
-              // Stray moves in the lobby should not affect the upcoming game.
-              clients.at(i)->current_move = cm;
-            }
-          }, msg);
+      size_t size = wire_size(msg);
+      if (limiter.admit(size)) {
+        handle_message(i, addr, msg);
+        continue;
       }
+
+      // Over the limits: the message goes and so does reading for a while,
+      // the socket's buffers fill up and TCP makes the flooder wait.
+      drop_message(i, size);
+      std::this_thread::sleep_for(limiter.backoff(size));
     } catch (std::exception& e) {
       // Upon any error/disconnection this thread says au revoir.
       dbg("[client_handler] Something bad happened: ", e.what());
       dbg("[client_handler] Disconnecting client ", addr);
-      {
-        std::lock_guard<std::mutex> lk{playing_clients_mutex};
-        playing_clients.erase(clients.at(i)->id);
+      disconnect(i);
+      return;
+    }
+  }
+}
+
+void RoboticServer::uring_loop()
+{
+  dbg("[uring] hello");
+  IoUring& ring = *recv_ring;
+  // The TCP socket and the Unix one (if any), whose accepts carry their
+  // index in place of a client's place.
+  std::vector<int> listening{tcp_acceptors.front().native_handle()};
+  if (unix_acceptor.has_value())
+    listening.push_back(unix_acceptor->native_handle());
+  std::vector<bool> accepting(listening.size(), false);
+  uint64_t failures = 0;
+  for (;;) {
+    // Accepting is paused while the server is full, as acceptor waits.
+    for (size_t l = 0; l < listening.size(); ++l) {
+      if (!accepting[l] && number_of_clients < MAX_CLIENTS) {
+        prep_accept(ring.sqe(), listening[l], uring_data(UringOp::accept, l));
+        accepting[l] = true;
       }
-      {
-        std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
-        clients.at(i) = {};
+    }
+
+    ring.submit(1);
+    ring.reap([&] (const io_uring_cqe& cqe) {
+      size_t i = static_cast<uint32_t>(cqe.user_data);
+      switch (static_cast<UringOp>(cqe.user_data >> 32)) {
+      case UringOp::accept:
+        accepting.at(i) = false;
+        if (cqe.res < 0)
+          dbg("[uring] Failed to accept: ", std::strerror(-cqe.res));
+        else
+          uring_take(ring, cqe.res, i == 0);
+        break;
+      case UringOp::recv:
+        uring_received(ring, i, cqe);
+        break;
+      case UringOp::hail:
+        uring_hailed(ring, i, cqe.res);
+        break;
+      case UringOp::resume:
+        uring_resume(ring, i);
+        break;
       }
-      --number_of_clients;
-      for_places.notify_all();
+    });
+
+    // Only recycling buffers, each failure leaves one fewer to receive into.
+    if (ring.failures() > failures) {
+      log_warn("[uring] Failed to recycle ", ring.failures() - failures,
+               " receive buffers: ", std::strerror(ring.last_error()));
+      failures = ring.failures();
+    }
+  }
+}
+
+void RoboticServer::uring_take(IoUring& ring, int fd, bool over_tcp)
+{
+  // Both listening sockets may have had a client come for the last place.
+  if (!take_client_place()) {
+    dbg("[uring] No place for a new client, closing the connection.");
+    close(fd);
+    return;
+  }
+
+  std::string addr;
+  ConnectedClient cl{generic::stream_protocol::socket{io_ctx}, false, 0, 0, false, {}};
+  try {
+    if (over_tcp) {
+      cl.sock.assign(generic::stream_protocol{AF_INET6, IPPROTO_TCP}, fd);
+      cl.sock.set_option(tcp::no_delay{true});
+    } else {
+      cl.sock.assign(generic::stream_protocol{AF_UNIX, 0}, fd);
+    }
+    addr = address_from_sock(cl.sock);
+  } catch (std::exception& e) {
+    dbg("[uring] Failed to take a client in: ", e.what());
+    if (!cl.sock.is_open())
+      close(fd);
+    free_client_place();
+    return;
+  }
+
+  dbg("[uring] Accepted new client ", addr);
+  std::vector<uint8_t> turns_bytes;
+  auto [i, snap] = take_place(std::move(cl), turns_bytes);
+  UringClient& uc = uring_clients.at(i);
+  uc.addr = std::move(addr);
+  uc.input.clear();
+  uc.snap = std::move(snap);
+  uc.outgoing = std::move(turns_bytes);
+  uc.parts = {std::span{*hello_bytes}, std::span{*uc.snap->handshake}, std::span{uc.outgoing}};
+  uc.sent = 0;
+  uc.limiter.emplace(input_messages, input_bytes);
+  uc.throttled = false;
+  uc.closing = false;
+  uc.sending = uring_send_hail(ring, i);
+  prep_recv_multishot(ring.sqe(), fd, RECV_GROUP, uring_data(UringOp::recv, i));
+  uc.receiving = true;
+}
+
+bool RoboticServer::uring_send_hail(IoUring& ring, size_t i)
+{
+  UringClient& uc = uring_clients.at(i);
+  size_t skip = uc.sent;
+  size_t count = 0;
+  for (std::span<const uint8_t> part : uc.parts) {
+    if (skip >= part.size()) {
+      skip -= part.size();
+      continue;
+    }
+
+    uc.iov[count++] = {const_cast<uint8_t*>(part.data()) + skip, part.size() - skip};
+    skip = 0;
+  }
+
+  if (count == 0)
+    return false;
+
+  uc.msg = {};
+  uc.msg.msg_iov = uc.iov.data();
+  uc.msg.msg_iovlen = count;
+  // Nobody else writes to the socket while the client is hailing.
+  prep_sendmsg(ring.sqe(), clients.at(i)->sock.native_handle(), &uc.msg,
+               uring_data(UringOp::hail, i));
+  return true;
+}
+
+void RoboticServer::uring_hailed(IoUring& ring, size_t i, int res)
+{
+  UringClient& uc = uring_clients.at(i);
+  uc.sending = false;
+  if (res < 0) {
+    dbg("[uring] Failed to hail ", uc.addr, ": ", std::strerror(-res));
+    // Ends the receive too, whoever is last drops the client.
+    shutdown(clients.at(i)->sock.native_handle(), SHUT_RDWR);
+  } else {
+    metrics.add(hail_bytes, static_cast<uint64_t>(res));
+    uc.sent += static_cast<size_t>(res);
+    uc.sending = uring_send_hail(ring, i);
+    // Catch up with what was broadcast in the meantime.
+    if (!uc.sending && take_backlog(i, uc.outgoing)) {
+      uc.parts = {std::span<const uint8_t>{}, std::span<const uint8_t>{}, std::span{uc.outgoing}};
+      uc.sent = 0;
+      uc.sending = uring_send_hail(ring, i);
+    }
+
+    if (!uc.sending) {
+      dbg("[uring] Client ", uc.addr, " added to the array of listening clients.");
+      uc.snap.reset();
+    }
+  }
+
+  if (!uc.sending && !uc.receiving)
+    uring_drop(i);
+}
+
+void RoboticServer::uring_throttle(size_t i, size_t size)
+{
+  // Like client_handler, who stops reading, so that TCP makes the flooder
+  // wait instead of this thread decoding all they send. Receiving resumes
+  // when the receive has ended and then the time has passed.
+  UringClient& uc = uring_clients.at(i);
+  int64_t ns = uc.limiter->backoff(size).count();
+  uc.resume_after = {ns / 1'000'000'000, ns % 1'000'000'000};
+  uc.throttled = true;
+}
+
+void RoboticServer::uring_decode(size_t i)
+{
+  UringClient& uc = uring_clients.at(i);
+  // Handle every whole message there is, the rest waits for more bytes (or
+  // for the client not to be throttled any more).
+  size_t used = 0;
+  while (!uc.closing && !uc.throttled && used < uc.input.size()) {
+    Deserialiser<ReaderMemory> deser{ReaderMemory{uc.input.data() + used, uc.input.size() - used}};
+    ClientMessage msg;
+    try {
+      deser >> msg;
+    } catch (std::exception& e) {
+      if (deser.readable().exhausted())
+        break;
+
+      dbg("[uring] Client ", uc.addr, " sent something bad: ", e.what());
+      uc.closing = true;
+      shutdown(clients.at(i)->sock.native_handle(), SHUT_RDWR);
+      break;
+    }
+
+    size_t size = deser.readable().position();
+    used += size;
+    if (uc.limiter->admit(size)) {
+      handle_message(i, uc.addr, msg);
+    } else {
+      // Only the message over the limits goes, as with client_handler, so
+      // that what follows is still read from a message's start.
+      drop_message(i, size);
+      uring_throttle(i, size);
+    }
+  }
+
+  uc.input.erase(uc.input.begin(), uc.input.begin() + static_cast<ptrdiff_t>(used));
+}
+
+void RoboticServer::uring_received(IoUring& ring, size_t i, const io_uring_cqe& cqe)
+{
+  UringClient& uc = uring_clients.at(i);
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    std::span<const uint8_t> bytes = ring.provided(id, static_cast<size_t>(std::max(cqe.res, 0)));
+    // What comes before the cancel takes effect is kept for later.
+    if (!uc.closing)
+      uc.input.insert(uc.input.end(), bytes.begin(), bytes.end());
+    ring.recycle(id);
+  }
+
+  bool was_throttled = uc.throttled;
+  uring_decode(i);
+
+  if (cqe.flags & IORING_CQE_F_MORE) {
+    if (uc.throttled && !was_throttled)
+      prep_cancel(ring.sqe(), uring_data(UringOp::recv, i), IoUring::OWN_DATA);
+    return;
+  }
+
+  // The receive has ended: out of buffers (or the like), cancelled when the
+  // client got throttled or the client is gone.
+  if (cqe.res > 0 || cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+    if (uc.throttled) {
+      prep_timeout(ring.sqe(), &uc.resume_after, uring_data(UringOp::resume, i));
       return;
     }
+
+    prep_recv_multishot(ring.sqe(), clients.at(i)->sock.native_handle(), RECV_GROUP,
+                        uring_data(UringOp::recv, i));
+    return;
   }
+
+  dbg("[uring] Disconnecting client ", uc.addr, ": ",
+      cqe.res == 0 ? "connection closed" : std::strerror(-cqe.res));
+  uc.receiving = false;
+  if (!uc.sending)
+    uring_drop(i);
+}
+
+void RoboticServer::uring_resume(IoUring& ring, size_t i)
+{
+  UringClient& uc = uring_clients.at(i);
+  uc.throttled = false;
+  // What was received meanwhile comes first, and may be over the limits
+  // again.
+  uring_decode(i);
+  if (uc.throttled) {
+    prep_timeout(ring.sqe(), &uc.resume_after, uring_data(UringOp::resume, i));
+    return;
+  }
+
+  prep_recv_multishot(ring.sqe(), clients.at(i)->sock.native_handle(), RECV_GROUP,
+                      uring_data(UringOp::recv, i));
+}
+
+void RoboticServer::uring_drop(size_t i)
+{
+  UringClient& uc = uring_clients.at(i);
+  uc.snap.reset();
+  uc.closing = false;
+  disconnect(i);
 }
 
 void RoboticServer::join_handler()
@@ -654,40 +1880,51 @@ void RoboticServer::join_handler()
     // all players are here...
     if (lobby && players.size() == players_count) {
       dbg("[join_handler] Required number of players joined, waking up the gm.");
-      {
-        // This is here so that when hailing someone we tell them the truth
-        // about the game having started or not.
-        std::lock_guard<std::shared_mutex> hail_lk{hail_mutex};
-        lobby = false;
-      }
+      // Those who connect from now on are told the game has started.
+      Serialiser ser;
+      ser << ServerMessage{server_messages::GameStarted{players}};
+      publish(false, hail_snapshot.load()->game + 1, share_bytes(ser));
+      lobby = false;
       // wake up the game master, he has waited enough did he not
       for_game.notify_all();
     }
 
     dbg("[join_handler] Waiting for any clients who want to join...");
     auto [i, player] = joined.pop();
+    join_pending.at(i) = false;
     dbg("[join_handler] Client ", player.first, "@", player.second, " wants to join.");
 
-    if (!lobby)
+    if (!lobby) {
+      if (resumed)
+        reclaim(i, player);
       continue;
+    }
 
     bool accepted = false;
     uint8_t id;
+    uint64_t version;
     {
       // Note: here we first lock clients_mutices[i] and then we lock
       // playing_clients_mutex and in gather_moves we do it vice versa. This
       // seems deadlock prone but locking here happens iff in lobby whereas
       // game_master only runs when this thread wakes them up when !lobby.
-      std::lock_guard<std::mutex> lk{clients_mutices.at(i)};
+      std::lock_guard lk{clients_mutices.at(i)};
       if (clients.at(i).has_value() && !clients.at(i)->in_game) {
         clients.at(i)->in_game = true;
         {
-          std::lock_guard<std::shared_mutex> write_lk{players_mutex};
+          std::lock_guard write_lk{players_mutex};
           id = get_free_id(players);
           players.insert({id, player});
+          // A new snapshot with this one appended, those hailing right now
+          // still have the old one.
+          std::shared_ptr<const HailSnapshot> snap = hail_snapshot.load();
+          Serialiser ser;
+          ser.append(*snap->handshake);
+          ser << ServerMessage{server_messages::AcceptedPlayer{id, player}};
+          version = publish(true, snap->game, share_bytes(ser));
         }
         {
-          std::lock_guard<std::mutex> lk{playing_clients_mutex};
+          std::lock_guard lk{playing_clients_mutex};
           playing_clients[id] = i;
         }
         clients.at(i)->id = id;
@@ -697,69 +1934,107 @@ void RoboticServer::join_handler()
     }
 
     if (accepted)
-      send_to_all(ServerMessage{server_messages::AcceptedPlayer{id, player}});
+      send_to_all(ServerMessage{server_messages::AcceptedPlayer{id, player}}, version);
   }
 }
 
 void RoboticServer::game_master()
 {
   dbg("[game_master] Hello!");
-  uint16_t turn_number = 0;
+  uint16_t turn_number = resume_turn;
+  if (resumed)
+    record_resumed();
   for (;;) {
-    server_messages::Turn current_turn{turn_number, {}};
     if (turn_number == game_len || lobby) {
       dbg("[game_master] Lobby, going to wait for players.");
-      {
-        std::lock_guard<std::shared_mutex> hail_lk{hail_mutex};
-        lobby = true;
-      }
+      lobby = true;
       std::unique_lock lk{game_master_mutex};
       for_game.wait(lk, [this] { return !lobby; });
       dbg("[game_master] Just woken up, starting a game, are we not?.");
       // We are awake, out of lobby. Let's get this going then shall we.
-      std::lock_guard<std::shared_mutex> write_lk{turns_mutex};
-      current_turn = start_game();
+      std::lock_guard write_lk{turns_mutex};
+      start_game();
       turn_number = 0;
-      turns_ser.drain_bytes();
-      turns_ser << ServerMessage{current_turn};
+      // Keeping the memory, next game's history is likely as long.
+      turns_ser.clear();
+      turns_ser.append(turn_encoder.bytes());
+      turns_game = hail_snapshot.load()->game;
+      turns_version = broadcasts.fetch_add(1) + 1;
     }
 
+    bool traced = false;
+    int64_t turn_start = 0;
+    // History only grows (amortised) so it is not accounted for here.
+    uint64_t allocs = 0;
+    outbox.clear();
+    std::shared_ptr<const HailSnapshot> snap;
     if (turn_number > 0) {
       dbg("[game_master] Waiting for ", turn_duration, "ms...");
       std::this_thread::sleep_for(std::chrono::milliseconds(turn_duration));
 
-      killed_this_turn = {};
-      destroyed_this_turn = {};
-      do_bombing(current_turn);
-      gather_moves(current_turn);
+      traced = tracer.sample();
+      if (traced)
+        turn_start = Tracer::now();
 
-      for (PlayerId id : killed_this_turn) {
-        dbg("[game master] Player ", static_cast<int>(id), " died, respawning them");
-        Position pos = {rand() % size_x, rand() % size_y};
-        positions[id] = pos;
-        current_turn.second.push_back(server_messages::PlayerMoved{id, pos});
-      }
+      auto start = steady_clock::now();
+      allocs = thread_allocations();
+      gather_moves(traced);
+      turn_encoder.begin(turn_number);
+      engine.step(actions, turn_encoder);
+      allocs = thread_allocations() - allocs;
 
-      std::lock_guard<std::shared_mutex> write_lk{turns_mutex};
-      turns_ser << ServerMessage{current_turn};
+      {
+        std::lock_guard write_lk{turns_mutex};
+        turns_ser.append(turn_encoder.bytes());
+        turns_version = broadcasts.fetch_add(1) + 1;
+      }
+      metrics.observe(turn_time, steady_clock::now() - start);
+      if (traced)
+        tracer.span("turn", TURN_LANE, turn_start, Tracer::now());
     } else {
-      server_messages::GameStarted gs = players;
+      // Serialised by join_handler as it closed the lobby.
+      snap = hail_snapshot.load();
       dbg("[game_master] Sending GameStarted to all.");
-      send_to_all(ServerMessage{gs});
+      outbox.emplace_back(snap->handshake.get(), snap->version);
+      record_bytes(JournalWriter::Kind::game_started, 0, *snap->handshake);
     }
 
-    dbg("[game_master] Turn ", current_turn.first, ", sending ",
-        current_turn.second.size(), " events to clients", "\n");
-    send_to_all(ServerMessage{current_turn});
+    // Only game_master writes turns_version, no need to lock for reading it.
+    outbox.emplace_back(&turn_encoder.bytes(), turns_version);
+    bool last = turn_number + 1 == game_len;
+    if (last) {
+      uint64_t version = prepare_game_end();
+      outbox.emplace_back(&game_ended_ser.to_bytes(), version);
+    }
 
-    for (PlayerId id : killed_this_turn)
-      ++scores.at(id);
+    dbg("[game_master] Turn ", turn_number, ", sending ",
+        turn_encoder.size(), " events to clients", "\n");
+    int64_t trace_broadcast = traced ? Tracer::now() : 0;
+    auto broadcast_start = steady_clock::now();
+    uint64_t broadcast_allocs = thread_allocations();
+    uint64_t hailing_allocs = send_ring ? uring_send_to_all(outbox) : send_bytes_to_all(outbox);
+    metrics.observe(broadcast_time, steady_clock::now() - broadcast_start);
+    if (traced) {
+      int64_t sent = Tracer::now();
+      tracer.span("broadcast", TURN_LANE, trace_broadcast, sent);
+      for (auto [idx, posted] : traced_moves) {
+        tracer.span("mailbox", static_cast<uint32_t>(idx), posted, turn_start);
+        tracer.span("input to broadcast", static_cast<uint32_t>(idx), posted, sent);
+      }
+    }
+    uint64_t recorded_allocs = thread_allocations();
+    record_bytes(JournalWriter::Kind::turn, turn_number, turn_encoder.bytes());
+    recorded_allocs = thread_allocations() - recorded_allocs;
+    if (turn_number > 0)
+      note_allocations(turn_number,
+                       allocs + thread_allocations() - broadcast_allocs - hailing_allocs
+                       - recorded_allocs, recorded_allocs);
 
-    for (Position pos : destroyed_this_turn)
-      blocks.erase(pos);
+    if (checkpoints && !last)
+      checkpoint(turn_number, snap.get());
 
     ++turn_number;
-    if (turn_number == game_len)
+    if (last)
       end_game();
   }
 }
@@ -767,10 +2042,61 @@ void RoboticServer::game_master()
 // Main server function.
 void RoboticServer::run()
 {
+  if (lock_profiler)
+    lock_profiler->report_on_exit();
+
   std::jthread gm_th{[this] { game_master(); }};
   std::jthread jh_th{[this] { join_handler(); }};
-  // Why waste the main thread, acceptor can have it.
-  acceptor();
+  std::jthread metrics_th;
+  if (metrics_socket.has_value())
+    metrics_th = std::jthread{[this] { metrics.serve(metrics_socket.value()); }};
+  // Why waste the main thread, acceptor (or uring_loop) can have it. More
+  // acceptors get a CPU each so that accepting scales.
+  if (recv_ring) {
+    uring_loop();
+    return;
+  }
+
+  std::vector<std::jthread> acceptor_ths;
+  if (handoff_acceptor.has_value())
+    acceptor_ths.emplace_back([this] { handoff_receiver(); });
+  if (unix_acceptor.has_value())
+    acceptor_ths.emplace_back([this] { acceptor(*unix_acceptor); });
+  for (size_t i = 1; i < tcp_acceptors.size(); ++i) {
+    acceptor_ths.emplace_back([this, i] {
+      pin_to_cpu(cpus, i);
+      acceptor(tcp_acceptors.at(i));
+    });
+  }
+  if (tcp_acceptors.size() > 1)
+    pin_to_cpu(cpus, 0);
+  acceptor(tcp_acceptors.front());
+}
+
+void RoboticServer::use_io_uring()
+{
+  auto recv = std::make_unique<IoUring>(URING_ENTRIES);
+  recv->provide_buffers(RECV_GROUP, RECV_BUFFERS, RECV_BUFFER_SIZE);
+  recv->probe();
+  auto send = std::make_unique<IoUring>(URING_ENTRIES);
+
+  // Sized for the worst turn there can be, with GameStarted (names and
+  // addresses of at most 255 bytes) and GameEnded along.
+  const GameRules& rules = engine.game_rules();
+  size_t game_started = 5 + players_count * (1 + 2 * (1 + 255));
+  size_t game_ended = 5 + players_count * (1 + sizeof(Score));
+  size_t turn = std::max(TurnEncoder::first_turn_bytes(players_count, rules.initial_blocks),
+                         TurnEncoder::max_turn_bytes(players_count));
+  staging_size = std::bit_ceil(game_started + turn + game_ended);
+  staging = std::make_unique<uint8_t[]>(staging_size);
+  std::array<iovec, 1> buffers{iovec{staging.get(), staging_size}};
+  send->register_buffers(buffers);
+  // Unlike asio's sends, WRITE_FIXED has no MSG_NOSIGNAL, and writing to a
+  // client who has reset the connection would kill the server.
+  std::signal(SIGPIPE, SIG_IGN);
+  recv_ring = std::move(recv);
+  send_ring = std::move(send);
+  dbg("Serving clients with io_uring, ", staging_size, " bytes registered for turns.");
 }
 
 } // namespace anonymous
@@ -789,6 +2115,18 @@ int main(int argc, char* argv[])
     uint16_t size_x;
     uint16_t size_y;
     uint16_t port;
+    size_t acceptors;
+    double input_messages;
+    double input_bytes;
+    std::optional<std::string> unix_socket;
+    std::optional<std::string> journal_dir;
+    std::optional<std::string> metrics_socket;
+    uint32_t trace_sample;
+    size_t feed_size;
+    size_t spectator_batch;
+    double spectator_rate;
+    uint16_t checkpoint_every;
+    std::string log_level;
 
     po::options_description desc{"Allowed flags for the robotic client"};
     desc.add_options()
@@ -796,6 +2134,25 @@ int main(int argc, char* argv[])
       ("server-name,n", po::value<std::string>(&name)->required(), "player name")
       ("port,p", po::value<uint16_t>(&port)->required(),
        "listen on port")
+      ("acceptors", po::value<size_t>(&acceptors)->default_value(1),
+       "listening sockets sharing the port (SO_REUSEPORT), each with its own acceptor")
+      ("unix-socket,u", po::value<std::string>(),
+       "also listen on a Unix stream socket at this path (see the client's unix:/path)")
+      ("spectator-port", po::value<uint16_t>(),
+       "serve spectators, who only watch, on this port")
+      ("spectator-batch", po::value<size_t>(&spectator_batch)->default_value(SPECTATOR_BATCH),
+       "send spectators turns in batches of this many")
+      ("spectator-rate", po::value<double>(&spectator_rate)->default_value(SPECTATOR_RATE),
+       "flush spectators' batches at most this many times a second even when "
+       "short of --spectator-batch turns, 0 for only full batches")
+      ("handoff-socket", po::value<std::string>(),
+       "take clients robots-router hands over on a Unix socket at this path")
+      ("input-messages", po::value<double>(&input_messages)->default_value(INPUT_MESSAGES_PER_SEC),
+       "messages a client may send per second (and at once), the rest is dropped, "
+       "0 for no limit")
+      ("input-bytes", po::value<double>(&input_bytes)->default_value(INPUT_BYTES_PER_SEC),
+       "bytes a client may send per second (and at once), the rest is dropped, "
+       "0 for no limit")
       ("bomb-timer,b", po::value<uint16_t>(&timer)->required())
       ("turn-duration,d", po::value<uint64_t>(&turn_duration)->required())
       ("players-count,c", po::value<uint16_t>(&players_count)->required())
@@ -807,6 +2164,30 @@ int main(int argc, char* argv[])
         "randomness' seed, defult is current unix time")
       ("size-x,x", po::value<uint16_t>(&size_x)->required())
       ("size-y,y", po::value<uint16_t>(&size_y)->required())
+      ("journal-dir,j", po::value<std::string>(),
+       "save every game to a journal in this directory (see robots-replay)")
+      ("checkpoint-dir", po::value<std::string>(),
+       "checkpoint the game in progress into this directory")
+      ("checkpoint-every", po::value<uint16_t>(&checkpoint_every)->default_value(CHECKPOINT_EVERY),
+       "turns between checkpoints")
+      ("resume", "carry on with the game of the latest checkpoint (see --checkpoint-dir)")
+      ("feed", po::value<std::string>(),
+       "publish every game to this POSIX shared memory object (see robots-replay)")
+      ("feed-size", po::value<size_t>(&feed_size)->default_value(FEED_SIZE),
+       "bytes of messages the feed keeps for its readers")
+      ("metrics-socket,m", po::value<std::string>(),
+       "serve metrics in the Prometheus text format on this Unix socket")
+      ("trace", po::value<std::string>(),
+       "trace latency of moves into this Chrome trace file")
+      ("trace-sample", po::value<uint32_t>(&trace_sample)->default_value(1),
+       "trace one in this many turns")
+      ("log-level", po::value<std::string>(&log_level)->default_value(debug ? "debug" : "info"),
+       "log level: debug, info, warn, error or off")
+      ("profile-locks", "profile contention of the server's locks, reported with the "
+       "metrics and on SIGINT or SIGTERM")
+      ("check-allocs", "abort on heap allocations in turns after the first game")
+      ("io-uring", "accept, receive and broadcast with io_uring, falling back to asio "
+       "if the kernel cannot")
     ;
 
     po::variables_map vm;
@@ -823,13 +2204,80 @@ int main(int argc, char* argv[])
     // notify about missing options only after printing help
     po::notify(vm);
 
+    set_log_level(log_level_from_name(log_level));
+
     if (players_count > std::numeric_limits<uint8_t>::max()) {
       throw ServerError{"players-count must fit in one byte!"};
     }
 
+    if (acceptors == 0)
+      throw ServerError{"Need at least one acceptor!"};
+
+    if (acceptors > 1 && vm.count("io-uring"))
+      throw ServerError{"io_uring accepts in a single thread, more acceptors are for asio!"};
+
+    if (vm.count("handoff-socket") && vm.count("io-uring"))
+      throw ServerError{"Handed over clients are served with asio, not io_uring!"};
+
+    // A Join of the longest name has to get through.
+    if ((input_messages != 0 && input_messages < 1)
+        || (input_bytes != 0 && input_bytes < 2 + std::numeric_limits<uint8_t>::max()))
+      throw ServerError{"Input limits too low to join the game!"};
+
+    if (checkpoint_every == 0)
+      throw ServerError{"Need at least one turn between checkpoints!"};
+
+    if (spectator_rate < 0)
+      throw ServerError{"Spectators cannot get batches a negative number of times a second!"};
+
+    if (vm.count("resume") && !vm.count("checkpoint-dir"))
+      throw ServerError{"Nothing to resume from without --checkpoint-dir!"};
+
+    if (vm.count("unix-socket"))
+      unix_socket = vm["unix-socket"].as<std::string>();
+
+    if (vm.count("journal-dir"))
+      journal_dir = vm["journal-dir"].as<std::string>();
+
+    if (vm.count("metrics-socket"))
+      metrics_socket = vm["metrics-socket"].as<std::string>();
+
     RoboticServer server{name, timer, static_cast<uint8_t>(players_count),
       turn_duration, radius, initial_blocks,
-      game_length, seed, size_x, size_y, port};
+      game_length, seed, size_x, size_y, port, acceptors, unix_socket, journal_dir,
+      metrics_socket};
+
+    if (vm.count("profile-locks"))
+      server.profile_locks();
+
+    if (vm.count("trace"))
+      server.trace_to(vm["trace"].as<std::string>(), trace_sample);
+
+    if (vm.count("checkpoint-dir"))
+      server.checkpoint_to(vm["checkpoint-dir"].as<std::string>(), checkpoint_every,
+                           vm.count("resume") > 0);
+
+    if (vm.count("spectator-port"))
+      server.spectate_on(vm["spectator-port"].as<uint16_t>(), spectator_batch, spectator_rate);
+
+    if (vm.count("feed"))
+      server.feed_to(vm["feed"].as<std::string>(), feed_size);
+
+    if (vm.count("check-allocs"))
+      server.check_allocations();
+
+    server.limit_input(input_messages, input_bytes);
+
+    if (vm.count("handoff-socket"))
+      server.accept_handoffs(vm["handoff-socket"].as<std::string>());
+
+    if (vm.count("io-uring")) {
+      try {
+        server.use_io_uring();
+      } catch (UringError& e) {
+        std::cerr << "No io_uring (" << e.what() << "), falling back to asio.\n";
+      }
+    }
 
     server.run();
   } catch (po::required_option& e) {
@@ -0,0 +1,298 @@
+// Headless simulator of the bomberperson game.
+
+// Plays games back to back with bots on the GameEngine alone, no sockets and
+// no threads involved, and reports how fast the rules run. Handy for profiling
+// the engine and for benchmarking changes to it.
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "alloc-hook.h"
+#include "batch.h"
+#include "engine.h"
+#include "mailbox.h"
+#include "marshal.h"
+#include "messages.h"
+
+namespace po = boost::program_options;
+
+using steady = std::chrono::steady_clock;
+
+using input_messages::InputMessage;
+
+namespace
+{
+
+class SimError : public std::runtime_error {
+public:
+  SimError() : runtime_error{"Simulator error!"} {}
+  SimError(const std::string& msg) : runtime_error{msg} {}
+};
+
+// How bots choose their moves.
+enum class Policy { idle, walker, bomber, random };
+
+Policy policy_from_name(const std::string& name)
+{
+  if (name == "idle")
+    return Policy::idle;
+  else if (name == "walker")
+    return Policy::walker;
+  else if (name == "bomber")
+    return Policy::bomber;
+  else if (name == "random")
+    return Policy::random;
+  else
+    throw SimError{"Unknown policy \"" + name + "\"!"};
+}
+
+class Bots {
+  Policy policy;
+  std::minstd_rand rand;
+public:
+  Bots(Policy policy, uint32_t seed) : policy{policy}, rand{seed} {}
+
+  std::optional<InputMessage> choose()
+  {
+    using namespace client_messages;
+    static const Direction dirs[] = {Up{}, Right{}, Down{}, Left{}};
+
+    switch (policy) {
+    case Policy::idle:
+      return {};
+    case Policy::walker:
+      return Move{dirs[rand() % 4]};
+    case Policy::bomber:
+      // Mostly walk around, every now and then leave a present.
+      if (rand() % 8 == 0)
+        return PlaceBomb{};
+      return Move{dirs[rand() % 4]};
+    case Policy::random:
+      switch (rand() % 7) {
+      case 0:
+        return {};
+      case 1:
+        return PlaceBomb{};
+      case 2:
+        return PlaceBlock{};
+      default:
+        return Move{dirs[rand() % 4]};
+      }
+    }
+
+    return {};
+  }
+
+  uint8_t choose_code()
+  {
+    std::optional<InputMessage> move = choose();
+    return move.has_value() ? encode_move(move.value()) : NO_MOVE;
+  }
+};
+
+// Only counts the events, for when they are not serialised.
+class CountingSink : public EventSink {
+public:
+  uint64_t events = 0;
+
+  void bomb_placed(BombId, Position) override { ++events; }
+  void bomb_exploded(BombId, std::span<const PlayerId>, std::span<const Position>) override { ++events; }
+  void player_moved(PlayerId, Position) override { ++events; }
+  void block_placed(Position) override { ++events; }
+};
+
+// Plays a batch of games in parallel, the way bot training would.
+void run_batch(const GameRules& rules, uint8_t players_count, uint32_t seed,
+               size_t games, size_t threads, uint64_t turns, Bots& bots)
+{
+  std::vector<uint32_t> seeds;
+  for (size_t g = 0; g < games; ++g)
+    seeds.push_back(static_cast<uint32_t>(seed + g));
+
+  GameBatch batch{rules, players_count, seeds, threads};
+  std::vector<uint8_t> moves(games * players_count);
+  uint64_t finished = 0;
+
+  auto start = steady::now();
+  for (uint64_t t = 0; t < turns; ++t) {
+    for (uint8_t& move : moves)
+      move = bots.choose_code();
+
+    batch.step(moves);
+    for (uint8_t done : batch.observations().done)
+      finished += done;
+  }
+
+  double secs = std::chrono::duration<double>(steady::now() - start).count();
+  double game_turns = static_cast<double>(turns * games);
+  std::cout << "games:\t\t" << games << "\n"
+            << "threads:\t" << batch.threads() << "\n"
+            << "steps:\t\t" << turns << "\n"
+            << "finished:\t" << finished << "\n"
+            << "seconds:\t" << secs << "\n"
+            << "steps/s:\t" << static_cast<double>(turns) / secs << "\n"
+            << "turns/s:\t" << game_turns / secs << "\n";
+}
+
+} // namespace anonymous
+
+int main(int argc, char* argv[])
+{
+  try {
+    uint16_t timer;
+    uint16_t players_count;
+    uint16_t radius;
+    uint16_t initial_blocks;
+    uint16_t game_length;
+    uint32_t seed;
+    uint16_t size_x;
+    uint16_t size_y;
+    uint64_t turns;
+    std::string policy_name;
+    size_t games;
+    size_t threads;
+
+    po::options_description desc{"Allowed flags for the simulator"};
+    desc.add_options()
+      ("help,h", "produce this help message")
+      ("bomb-timer,b", po::value<uint16_t>(&timer)->default_value(5))
+      ("players-count,c", po::value<uint16_t>(&players_count)->default_value(8))
+      ("explosion-radius,e", po::value<uint16_t>(&radius)->default_value(3))
+      ("initial-blocks,k", po::value<uint16_t>(&initial_blocks)->default_value(100))
+      ("game-length,l", po::value<uint16_t>(&game_length)->default_value(1000))
+      ("seed,s", po::value<uint32_t>(&seed)->default_value(2137))
+      ("size-x,x", po::value<uint16_t>(&size_x)->default_value(32))
+      ("size-y,y", po::value<uint16_t>(&size_y)->default_value(32))
+      ("turns,t", po::value<uint64_t>(&turns)->default_value(1000000),
+       "number of turns to simulate, games are restarted as they end")
+      ("policy,P", po::value<std::string>(&policy_name)->default_value("bomber"),
+       "bot policy: idle, walker, bomber or random")
+      ("serialise,S", "also serialise each turn as the server would")
+      ("games,g", po::value<size_t>(&games)->default_value(1),
+       "play this many games at once (batched, as for bot training)")
+      ("threads,T", po::value<size_t>(&threads)->default_value(0),
+       "threads to step the batch with, 0 means all cores")
+      ("check-allocs", "serialise and fail if any turn after the first game allocates")
+    ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).
+              options(desc).run(), vm);
+
+    if (vm.count("help")) {
+      std::cout << "\t\tBOMBERPERSON\n";
+      std::cout << "Usage: " << argv[0] <<  " [flags]\n";
+      std::cout << desc;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    if (players_count > std::numeric_limits<uint8_t>::max())
+      throw SimError{"players-count must fit in one byte!"};
+
+    if (size_x == 0 || size_y == 0)
+      throw SimError{"The board cannot be empty!"};
+
+    bool check_allocs = vm.count("check-allocs");
+    bool serialise = check_allocs || vm.count("serialise");
+    Bots bots{policy_from_name(policy_name), seed};
+    GameRules rules{size_x, size_y, game_length, radius, timer, initial_blocks};
+
+    if (games > 1) {
+      // Here turns count steps of the whole batch.
+      run_batch(rules, static_cast<uint8_t>(players_count), seed, games, threads,
+                turns, bots);
+      return 0;
+    }
+
+    GameEngine engine{rules, seed};
+
+    std::set<PlayerId> players;
+    for (uint16_t id = 0; id < players_count; ++id)
+      players.insert(static_cast<PlayerId>(id));
+
+    Actions actions(players_count);
+    TurnEncoder encoder;
+    encoder.reserve(std::max(TurnEncoder::first_turn_bytes(players_count, initial_blocks),
+                             TurnEncoder::max_turn_bytes(players_count)));
+    CountingSink counter;
+    EventSink& sink = serialise ? static_cast<EventSink&>(encoder) : counter;
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    uint64_t played = 0;
+    // Turns past the first game (which warms the buffers up) that allocated.
+    uint64_t allocating = 0;
+    bool fresh = true;
+
+    auto start = steady::now();
+    for (uint64_t t = 0; t < turns; ++t) {
+      uint64_t allocs = thread_allocations();
+      encoder.begin(fresh ? 0 : static_cast<uint16_t>(engine.turn() + 1));
+      counter.events = 0;
+      if (fresh) {
+        engine.start(players, sink);
+        ++played;
+        fresh = false;
+      } else {
+        for (auto& action : actions)
+          action = bots.choose();
+
+        engine.step(actions, sink);
+      }
+
+      if (serialise) {
+        events += encoder.size();
+        bytes += encoder.bytes().size();
+      } else {
+        events += counter.events;
+      }
+
+      // Starting a game is not on the turn path, the server does it between
+      // games.
+      if (played > 1 && engine.turn() > 0 && thread_allocations() != allocs)
+        ++allocating;
+
+      if (engine.finished())
+        fresh = true;
+    }
+
+    double secs = std::chrono::duration<double>(steady::now() - start).count();
+    std::cout << "turns:\t\t" << turns << "\n"
+              << "games:\t\t" << played << "\n"
+              << "events:\t\t" << events << "\n"
+              << "seconds:\t" << secs << "\n"
+              << "turns/s:\t" << static_cast<double>(turns) / secs << "\n"
+              << "events/s:\t" << static_cast<double>(events) / secs << "\n";
+
+    if (serialise)
+      std::cout << "bytes/s:\t" << static_cast<double>(bytes) / secs << "\n";
+
+    if (check_allocs) {
+      std::cout << "allocating turns:\t" << allocating << "\n";
+      if (allocating > 0)
+        return 1;
+    }
+  } catch (po::error& e) {
+    std::cerr << "Bad options: " << e.what() << "\n";
+    std::cerr << "See " << argv[0] << " -h for help.\n";
+    return 1;
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,236 @@
+// Implementation of serving spectators.
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/write.hpp>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "spectators.h"
+#include "dbg.h"
+
+using boost::asio::ip::tcp;
+
+SpectatorHub::SpectatorHub(const std::vector<uint8_t>& hello, uint16_t port, size_t batch_turns,
+                           double rate)
+  : hello{std::make_shared<const std::vector<uint8_t>>(hello)},
+    batch_turns{std::max<size_t>(batch_turns, 1)},
+    flush_every{rate > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                             std::chrono::duration<double>(1 / rate))
+                         : std::chrono::steady_clock::duration::zero()},
+    work{boost::asio::make_work_guard(io_ctx)},
+    acceptor{io_ctx, tcp::endpoint{tcp::v6(), port}},
+    wakeup{io_ctx},
+    flush_timer{io_ctx}
+{
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd < 0)
+    throw std::runtime_error{std::string{"Cannot make an eventfd: "} + std::strerror(errno)};
+  wakeup.assign(fd);
+
+  accept();
+  wait_for_messages();
+  thread = std::jthread{[this] { io_ctx.run(); }};
+}
+
+SpectatorHub::~SpectatorHub()
+{
+  io_ctx.stop();
+}
+
+void SpectatorHub::publish(Kind kind, std::span<const uint8_t> bytes)
+{
+  bool first;
+  {
+    std::lock_guard lk{incoming_mutex};
+    first = incoming_kinds.empty();
+    incoming.insert(incoming.end(), bytes.begin(), bytes.end());
+    incoming_kinds.emplace_back(kind, bytes.size());
+  }
+
+  // Those after the first are taken along with it.
+  if (first) {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = ::write(wakeup.native_handle(), &one, sizeof(one));
+  }
+}
+
+void SpectatorHub::wait_for_messages()
+{
+  wakeup.async_read_some(boost::asio::buffer(&wakeups, sizeof(wakeups)),
+                         [this] (boost::system::error_code ec, size_t) {
+      if (ec == boost::asio::error::operation_aborted)
+        return;
+
+      // Buffers are swapped, both keep their capacity for the next time.
+      taking.clear();
+      taking_kinds.clear();
+      {
+        std::lock_guard lk{incoming_mutex};
+        std::swap(incoming, taking);
+        std::swap(incoming_kinds, taking_kinds);
+      }
+
+      size_t offset = 0;
+      for (auto [kind, size] : taking_kinds) {
+        take(kind, std::span{taking}.subspan(offset, size));
+        offset += size;
+      }
+      wait_for_messages();
+    });
+}
+
+void SpectatorHub::accept()
+{
+  acceptor.async_accept([this] (boost::system::error_code ec, tcp::socket sock) {
+      if (!ec && spectators.size() < MAX_SPECTATORS) {
+        sock.set_option(tcp::no_delay{true}, ec);
+        uint64_t id = next_id++;
+        spectators.emplace(id, Spectator{std::move(sock), {}, 0, {}});
+        count = spectators.size();
+        dbg("[spectators] Spectator ", id, " connected, ", spectators.size(), " watching.");
+
+        send(id, hello);
+        if (!history.empty())
+          send(id, std::make_shared<const std::vector<uint8_t>>(history));
+        read(id);
+      } else if (ec) {
+        dbg("[spectators] Failed to accept: ", ec.message());
+      }
+      // Above the limit the socket goes right away.
+      accept();
+    });
+}
+
+void SpectatorHub::take(Kind kind, std::span<const uint8_t> bytes)
+{
+  if (kind == Kind::game_started)
+    history.clear();
+
+  if (batch.empty() && flush_every > std::chrono::steady_clock::duration::zero()) {
+    flush_timer.expires_after(flush_every);
+    flush_timer.async_wait([this, batch_of = flushed] (boost::system::error_code ec) {
+        if (!ec && batch_of == flushed)
+          flush();
+      });
+  }
+
+  batch.insert(batch.end(), bytes.begin(), bytes.end());
+  if (kind == Kind::turn)
+    ++batched;
+
+  if (kind == Kind::game_ended) {
+    flush();
+    // Those who come in the lobby only get Hello, like players do before
+    // AcceptedPlayers.
+    history.clear();
+  } else if (batched >= batch_turns) {
+    flush();
+  }
+}
+
+void SpectatorHub::flush()
+{
+  if (batch.empty())
+    return;
+
+  // Flushed before its time, the next batch sets it again.
+  flush_timer.cancel();
+  history.insert(history.end(), batch.begin(), batch.end());
+  SharedBytes bytes = std::make_shared<const std::vector<uint8_t>>(std::move(batch));
+  batch = {};
+  batched = 0;
+  ++flushed;
+
+  // Collected first, send may drop spectators.
+  std::vector<uint64_t> ids;
+  ids.reserve(spectators.size());
+  for (auto& [id, spectator] : spectators)
+    ids.push_back(id);
+  for (uint64_t id : ids)
+    send(id, bytes);
+}
+
+void SpectatorHub::send(uint64_t id, SharedBytes bytes)
+{
+  auto it = spectators.find(id);
+  if (it == spectators.end())
+    return;
+
+  Spectator& spectator = it->second;
+  // The hail itself may be bigger than the limit, it is allowed to go.
+  if (!spectator.outgoing.empty() && spectator.queued + bytes->size() > SPECTATOR_BACKLOG) {
+    dbg("[spectators] Spectator ", id, " lags behind, disconnecting.");
+    ++dropped;
+    drop(id);
+    return;
+  }
+
+  spectator.queued += bytes->size();
+  spectator.outgoing.push_back(std::move(bytes));
+  if (spectator.outgoing.size() == 1)
+    write(id);
+}
+
+void SpectatorHub::write(uint64_t id)
+{
+  Spectator& spectator = spectators.at(id);
+  // The buffer lives as long as it is at the front of outgoing.
+  boost::asio::async_write(spectator.sock, boost::asio::buffer(*spectator.outgoing.front()),
+                           [this, id] (boost::system::error_code ec, size_t) {
+      auto it = spectators.find(id);
+      if (it == spectators.end())
+        return;
+
+      if (ec) {
+        drop(id);
+        return;
+      }
+
+      Spectator& spectator = it->second;
+      spectator.queued -= spectator.outgoing.front()->size();
+      spectator.outgoing.pop_front();
+      if (!spectator.outgoing.empty())
+        write(id);
+    });
+}
+
+void SpectatorHub::read(uint64_t id)
+{
+  Spectator& spectator = spectators.at(id);
+  spectator.sock.async_read_some(boost::asio::buffer(spectator.input),
+                                 [this, id] (boost::system::error_code ec, size_t) {
+      if (!spectators.contains(id))
+        return;
+
+      if (ec)
+        drop(id);
+      else
+        read(id);
+    });
+}
+
+void SpectatorHub::drop(uint64_t id)
+{
+  auto it = spectators.find(id);
+  if (it == spectators.end())
+    return;
+
+  // Pending handlers find the spectator gone and do nothing.
+  boost::system::error_code ec;
+  it->second.sock.close(ec);
+  spectators.erase(it);
+  count = spectators.size();
+  dbg("[spectators] Spectator ", id, " gone, ", spectators.size(), " watching.");
+}
@@ -0,0 +1,133 @@
+// Spectators: those who only watch the games, on a port of their own.
+
+// Players and observers who may yet join are sent every turn by game_master
+// itself, as soon as it is played. Spectators are not: they connect to a
+// separate port, never take a client's place (nor count as playing) and are
+// served by a SpectatorHub on a thread and io_context of its own. game_master
+// only hands it a copy of each message after it has broadcast it, whatever
+// the number of spectators. The copy goes to buffers kept from turn to turn
+// and the hub is woken with an eventfd, so handing over does not allocate.
+//
+// The hub sends turns in batches, every K turns (and at the end of a game)
+// all at once in a single write to each spectator. Given a rate of flushes
+// per second, a batch also goes once 1/rate seconds have passed since its
+// first message, whichever comes first. With K large that caps the flushes
+// at rate a second however short the turns are. The messages themselves
+// are kept as they are, clients count bomb timers in Turn messages, so a
+// batch is those K Turns back to back rather than one Turn of all their
+// events. Spectators are hailed with Hello and, during a game, GameStarted
+// and the turns batched so far. Those who cannot keep up (with more than
+// SPECTATOR_BACKLOG bytes waiting for them) are disconnected.
+
+#ifndef _SPECTATORS_H_
+#define _SPECTATORS_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr size_t MAX_SPECTATORS = 1024;
+constexpr size_t SPECTATOR_BACKLOG = 1 << 20;
+
+class SpectatorHub {
+public:
+  enum class Kind : uint8_t { game_started, turn, game_ended };
+
+private:
+  using SharedBytes = std::shared_ptr<const std::vector<uint8_t>>;
+
+  struct Spectator {
+    boost::asio::ip::tcp::socket sock;
+    // What is to be written, the front being written now.
+    std::deque<SharedBytes> outgoing;
+    size_t queued = 0;
+    // Whatever they say is read (to notice them leaving) and ignored.
+    std::array<uint8_t, 64> input;
+  };
+
+  const SharedBytes hello;
+  const size_t batch_turns;
+  // Zero when batches wait for batch_turns alone.
+  const std::chrono::steady_clock::duration flush_every;
+
+  // Messages handed over and not yet taken by the hub: their bytes back to
+  // back and the kind and size of each.
+  std::mutex incoming_mutex;
+  std::vector<uint8_t> incoming;
+  std::vector<std::pair<Kind, size_t>> incoming_kinds;
+
+  // All the rest is the hub thread's, woken up by game_master through the
+  // eventfd.
+  boost::asio::io_context io_ctx;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+  boost::asio::ip::tcp::acceptor acceptor;
+  boost::asio::posix::stream_descriptor wakeup;
+  uint64_t wakeups = 0;
+  std::vector<uint8_t> taking;
+  std::vector<std::pair<Kind, size_t>> taking_kinds;
+  std::map<uint64_t, Spectator> spectators;
+  uint64_t next_id = 0;
+  std::atomic_size_t count = 0;
+  std::atomic_uint64_t dropped = 0;
+
+  // Messages of the game sent so far (for hailing) and of the next batch.
+  std::vector<uint8_t> history;
+  std::vector<uint8_t> batch;
+  size_t batched = 0;
+  // Flushes the batch once flush_every has passed, set with its first message.
+  // Batches flushed so far tell a timer gone off too late from a current one.
+  boost::asio::steady_timer flush_timer;
+  uint64_t flushed = 0;
+
+  // Last so that it is joined before the rest goes away.
+  std::jthread thread;
+public:
+  // A rate of 0 means no flushes but those of batch_turns.
+  SpectatorHub(const std::vector<uint8_t>& hello, uint16_t port, size_t batch_turns,
+               double rate);
+  ~SpectatorHub();
+
+  SpectatorHub(const SpectatorHub&) = delete;
+  SpectatorHub& operator=(const SpectatorHub&) = delete;
+
+  // Hand a serialised message over to the hub, never waits for it.
+  void publish(Kind kind, std::span<const uint8_t> bytes);
+
+  size_t spectators_count() const
+  {
+    return count.load(std::memory_order_relaxed);
+  }
+
+  // Spectators disconnected for lagging behind.
+  uint64_t dropped_spectators() const
+  {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  void accept();
+  void wait_for_messages();
+  void take(Kind kind, std::span<const uint8_t> bytes);
+  void flush();
+  void send(uint64_t id, SharedBytes bytes);
+  void write(uint64_t id);
+  void read(uint64_t id);
+  void drop(uint64_t id);
+};
+
+#endif  // _SPECTATORS_H_
@@ -0,0 +1,18 @@
+// Implementation of reading TCP connection statistics.
+
+#include <cstdint>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "tcp-info.h"
+
+uint64_t tcp_segments_out(int fd)
+{
+  tcp_info info{};
+  socklen_t len = sizeof(info);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    return 0;
+
+  return info.tcpi_segs_out;
+}
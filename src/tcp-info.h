@@ -0,0 +1,14 @@
+// Statistics the kernel keeps of a TCP connection.
+
+// Kept apart as <linux/tcp.h>, the only one with the newer fields of tcp_info,
+// does not get along with <netinet/tcp.h> which asio includes.
+
+#ifndef _TCP_INFO_H_
+#define _TCP_INFO_H_
+
+#include <cstdint>
+
+// Segments sent over the connection so far, 0 if the kernel does not say.
+uint64_t tcp_segments_out(int fd);
+
+#endif  // _TCP_INFO_H_
@@ -0,0 +1,93 @@
+// Implementation of the latency tracer.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#include "trace.h"
+
+void Tracer::enable(uint32_t sample_every)
+{
+  this->sample_every = std::max<uint32_t>(sample_every, 1);
+  if (!ring)
+    ring = std::make_unique<Record[]>(TRACE_CAPACITY);
+
+  on.store(true, std::memory_order_release);
+}
+
+void Tracer::span(const char* name, uint32_t lane, int64_t start, int64_t end)
+{
+  if (!enabled())
+    return;
+
+  uint64_t idx = next.fetch_add(1, std::memory_order_relaxed);
+  Record& rec = ring[idx % TRACE_CAPACITY];
+  rec.seq.store(2 * idx + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  rec.name.store(name, std::memory_order_relaxed);
+  rec.lane.store(lane, std::memory_order_relaxed);
+  rec.start.store(start, std::memory_order_relaxed);
+  rec.end.store(end, std::memory_order_relaxed);
+  rec.seq.store(2 * idx + 2, std::memory_order_release);
+}
+
+void Tracer::dump(const std::string& path, const std::string& process) const
+{
+  if (!ring)
+    return;
+
+  std::string tmp = path + ".tmp";
+  std::ofstream out{tmp, std::ios::trunc};
+  if (!out) {
+    std::cerr << "Failed to open the trace file " << tmp << "\n";
+    return;
+  }
+
+  int pid = getpid();
+  out << std::fixed << std::setprecision(3);
+  out << "{\"traceEvents\":[\n"
+      << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+      << ",\"args\":{\"name\":\"" << process << "\"}}";
+
+  for (size_t i = 0; i < TRACE_CAPACITY; ++i) {
+    const Record& rec = ring[i];
+    uint64_t seq = rec.seq.load(std::memory_order_acquire);
+    if (seq == 0 || seq % 2 == 1)
+      continue;
+
+    const char* name = rec.name.load(std::memory_order_relaxed);
+    uint32_t lane = rec.lane.load(std::memory_order_relaxed);
+    int64_t start = rec.start.load(std::memory_order_relaxed);
+    int64_t end = rec.end.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Overwritten while we were reading it.
+    if (rec.seq.load(std::memory_order_relaxed) != seq)
+      continue;
+
+    // Chrome wants microseconds, fractions are fine.
+    out << ",\n{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":" << pid
+        << ",\"tid\":" << lane
+        << ",\"ts\":" << static_cast<double>(start) / 1e3
+        << ",\"dur\":" << static_cast<double>(end - start) / 1e3 << "}";
+  }
+
+  out << "\n]}\n";
+  out.close();
+  if (!out) {
+    std::cerr << "Failed to write the trace file " << tmp << "\n";
+    return;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec)
+    std::cerr << "Failed to write the trace file " << path << ": " << ec.message() << "\n";
+}
@@ -0,0 +1,78 @@
+// Sampled latency tracing of the way from a key press to a Turn.
+
+// Stages of handling a move (or a turn) are recorded as spans, ie. a name, a
+// lane and start and end timestamps, into a fixed ring buffer. The newest
+// records overwrite the oldest so tracing can stay on for as long as needed.
+// The buffer is dumped as Chrome trace JSON (chrome://tracing or Perfetto).
+//
+// Tracing is always compiled in but is off unless enabled at runtime, then
+// every call site costs a single relaxed load. Names must be string literals:
+// records keep the pointer and nothing is formatted until dumping.
+//
+// Timestamps come from the monotonic clock which is shared by all processes
+// on a machine, hence traces of the client and the server put side by side
+// show the whole way of a move.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+constexpr size_t TRACE_CAPACITY = 1 << 14;
+
+class Tracer {
+  struct Record {
+    // Odd while being written, 2 * (index + 1) when done (a seqlock).
+    std::atomic_uint64_t seq = 0;
+    std::atomic<const char*> name = nullptr;
+    std::atomic_uint32_t lane = 0;
+    std::atomic_int64_t start = 0;
+    std::atomic_int64_t end = 0;
+  };
+
+  std::unique_ptr<Record[]> ring;
+  std::atomic_uint64_t next = 0;
+  std::atomic_bool on = false;
+  uint32_t sample_every = 1;
+  std::atomic_uint32_t sampled = 0;
+public:
+  Tracer() {}
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  // Turn tracing on (before the threads start), recording one in sample_every
+  // of what is sampled.
+  void enable(uint32_t sample_every = 1);
+
+  bool enabled() const
+  {
+    return on.load(std::memory_order_relaxed);
+  }
+
+  // Nanoseconds of the monotonic clock.
+  static int64_t now()
+  {
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+  }
+
+  // Whether this one (a turn, an input...) should be traced.
+  bool sample()
+  {
+    return enabled() && sampled.fetch_add(1, std::memory_order_relaxed) % sample_every == 0;
+  }
+
+  // Record a span, a no-op while tracing is off.
+  void span(const char* name, uint32_t lane, int64_t start, int64_t end);
+
+  // Write the buffer as Chrome trace JSON, the file is replaced atomically.
+  void dump(const std::string& path, const std::string& process) const;
+};
+
+#endif  // _TRACE_H_
@@ -0,0 +1,271 @@
+// Implementation of the io_uring wrapper.
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "uring.h"
+
+namespace
+{
+
+std::string error_text(const std::string& what, int err)
+{
+  return what + ": " + std::strerror(err);
+}
+
+void* map_ring(int fd, size_t size, uint64_t offset)
+{
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                 static_cast<off_t>(offset));
+  if (p == MAP_FAILED)
+    throw UringError{error_text("Failed to map the io_uring", errno)};
+
+  return p;
+}
+
+template <typename T>
+T* at(void* ring, uint32_t offset)
+{
+  return reinterpret_cast<T*>(static_cast<uint8_t*>(ring) + offset);
+}
+
+// User data of probe's requests.
+constexpr uint64_t PROBE_RECV = IoUring::OWN_DATA - 1;
+constexpr uint64_t PROBE_CANCEL = IoUring::OWN_DATA - 2;
+
+} // namespace anonymous
+
+IoUring::IoUring(uint32_t entries)
+{
+  fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0)
+    throw UringError{error_text("io_uring_setup failed", errno)};
+
+  try {
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = map_ring(fd, sq_ring_size, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = map_ring(fd, cq_ring_size, IORING_OFF_CQ_RING);
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(map_ring(fd, sqes_size, IORING_OFF_SQES));
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  sq_head = at<uint32_t>(sq_ring, params.sq_off.head);
+  sq_tail = at<uint32_t>(sq_ring, params.sq_off.tail);
+  sq_array = at<uint32_t>(sq_ring, params.sq_off.array);
+  sq_mask = *at<uint32_t>(sq_ring, params.sq_off.ring_mask);
+  cq_head = at<uint32_t>(cq_ring, params.cq_off.head);
+  cq_tail = at<uint32_t>(cq_ring, params.cq_off.tail);
+  cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+  cq_mask = *at<uint32_t>(cq_ring, params.cq_off.ring_mask);
+}
+
+IoUring::~IoUring()
+{
+  release();
+}
+
+void IoUring::release()
+{
+  if (sqes)
+    munmap(sqes, sqes_size);
+  if (cq_ring && cq_ring != sq_ring)
+    munmap(cq_ring, cq_ring_size);
+  if (sq_ring)
+    munmap(sq_ring, sq_ring_size);
+  if (fd >= 0)
+    close(fd);
+}
+
+int IoUring::enter(uint32_t submit, uint32_t wait, uint32_t flags)
+{
+  for (;;) {
+    long ret = syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+    if (ret >= 0)
+      return static_cast<int>(ret);
+    if (errno != EINTR)
+      throw UringError{error_text("io_uring_enter failed", errno)};
+  }
+}
+
+io_uring_sqe* IoUring::sqe()
+{
+  uint32_t tail = *sq_tail;
+  if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == params.sq_entries) {
+    submit();
+    tail = *sq_tail;
+  }
+
+  uint32_t idx = tail & sq_mask;
+  sq_array[idx] = idx;
+  io_uring_sqe* e = &sqes[idx];
+  std::memset(e, 0, sizeof(*e));
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++to_submit;
+  return e;
+}
+
+void IoUring::submit(uint32_t wait)
+{
+  uint32_t flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+  // The kernel takes SQEs in order, some may be left if it runs out of memory.
+  while (to_submit > 0) {
+    int done = enter(to_submit, wait, flags);
+    to_submit -= static_cast<uint32_t>(done);
+    wait = 0;
+    flags = 0;
+    if (done == 0)
+      throw UringError{"io_uring took no submissions!"};
+  }
+
+  if (wait > 0)
+    enter(0, wait, flags);
+}
+
+void IoUring::register_buffers(std::span<const iovec> buffers)
+{
+  // Nothing registered yet is fine.
+  syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(),
+              static_cast<unsigned>(buffers.size())) < 0)
+    throw UringError{error_text("Failed to register buffers", errno)};
+}
+
+namespace
+{
+
+void prep_provide_buffers(io_uring_sqe* sqe, uint8_t* addr, uint16_t count, size_t size,
+                          uint16_t group, uint16_t first)
+{
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = count;
+  sqe->addr = reinterpret_cast<uint64_t>(addr);
+  sqe->len = static_cast<uint32_t>(size);
+  sqe->off = first;
+  sqe->buf_group = group;
+  sqe->user_data = IoUring::OWN_DATA;
+}
+
+} // namespace anonymous
+
+void IoUring::provide_buffers(uint16_t group, uint16_t count, size_t size)
+{
+  if (buf_memory)
+    throw UringError{"Buffers have been provided already!"};
+
+  buf_memory = std::make_unique<uint8_t[]>(count * size);
+  buf_size = size;
+  buf_group = group;
+  io_uring_sqe* e = sqe();
+  prep_provide_buffers(e, buf_memory.get(), count, size, group, 0);
+  // Just this once the completion is waited for, to know it went well.
+  submit(1);
+  uint32_t head = *cq_head;
+  uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  int res = 0;
+  for (; head != tail; ++head) {
+    if (cqes[head & cq_mask].user_data == OWN_DATA)
+      res = std::min(res, cqes[head & cq_mask].res);
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  if (res < 0)
+    throw UringError{error_text("Failed to provide buffers", -res)};
+}
+
+void IoUring::recycle(uint16_t id)
+{
+  io_uring_sqe* e = sqe();
+  prep_provide_buffers(e, buf_memory.get() + id * buf_size, 1, buf_size, buf_group, id);
+  e->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+template <typename F>
+void IoUring::wait_until(F&& f)
+{
+  for (;;) {
+    submit(1);
+    uint32_t head = *cq_head;
+    uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    bool done = false;
+    for (; head != tail && !done; ++head)
+      done = f(cqes[head & cq_mask]);
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    if (done)
+      return;
+  }
+}
+
+void IoUring::probe()
+{
+  if (!(params.features & IORING_FEAT_CQE_SKIP))
+    throw UringError{"io_uring cannot skip successful completions!"};
+  if (!buf_memory)
+    throw UringError{"No buffers provided to probe receiving with!"};
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    throw UringError{error_text("Failed to make a socket pair", errno)};
+
+  uint8_t byte = 0;
+  int res = -EIO;
+  uint32_t flags = 0;
+  if (::write(pair[1], &byte, 1) == 1) {
+    prep_recv_multishot(sqe(), pair[0], buf_group, PROBE_RECV);
+    wait_until([&] (const io_uring_cqe& cqe) {
+        if (cqe.user_data != PROBE_RECV)
+          return false;
+
+        res = cqe.res;
+        flags = cqe.flags;
+        return true;
+      });
+  }
+
+  // Still receiving, as it should be, until cancelled.
+  if (flags & IORING_CQE_F_MORE) {
+    prep_cancel(sqe(), PROBE_RECV, PROBE_CANCEL);
+    bool cancelled = false;
+    bool ended = false;
+    wait_until([&] (const io_uring_cqe& cqe) {
+        if (cqe.user_data == PROBE_CANCEL)
+          cancelled = true;
+        else if (cqe.user_data == PROBE_RECV && !(cqe.flags & IORING_CQE_F_MORE))
+          ended = true;
+        return cancelled && ended;
+      });
+  }
+
+  close(pair[0]);
+  close(pair[1]);
+  if (flags & IORING_CQE_F_BUFFER)
+    recycle(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+
+  if (res < 0)
+    throw UringError{error_text("Multishot receives fail", -res)};
+  if (!(flags & IORING_CQE_F_MORE))
+    throw UringError{"Receives are not multishot!"};
+}
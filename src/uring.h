@@ -0,0 +1,212 @@
+// A small io_uring, set up with the raw system calls (there is no liburing).
+
+// A ring is a submission queue of requests (SQEs) and a completion queue of
+// their results (CQEs) shared with the kernel, so that many requests cost a
+// single io_uring_enter, or none at all when only reaping completions. What
+// the server needs is here and nothing more:
+//  - registered buffers, pinned once so that writes from them (WRITE_FIXED)
+//    do not map the pages every time,
+//  - provided buffers, which multishot receives pick from as data comes (one
+//    request per connection for good, a CQE per chunk received). They are
+//    provided with PROVIDE_BUFFERS requests rather than a registered buffer
+//    ring, which some kernels leave empty.
+// Kernels with io_uring but without multishot receives (before 6.0) or
+// without skipping successful completions (before 5.17) fail probe, so that
+// the server does not find out from its clients' receives.
+//
+// A ring is meant for a single thread: whoever submits also reaps.
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+class UringError : public std::runtime_error {
+public:
+  UringError() : runtime_error{"io_uring error!"} {}
+  UringError(const std::string& msg) : runtime_error{msg} {}
+};
+
+class IoUring {
+  int fd = -1;
+  io_uring_params params{};
+
+  // The mapped rings.
+  void* sq_ring = nullptr;
+  size_t sq_ring_size = 0;
+  void* cq_ring = nullptr;
+  size_t cq_ring_size = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqes_size = 0;
+
+  // Pointers into them.
+  uint32_t* sq_head;
+  uint32_t* sq_tail;
+  uint32_t* sq_array;
+  uint32_t sq_mask;
+  uint32_t* cq_head;
+  uint32_t* cq_tail;
+  io_uring_cqe* cqes;
+  uint32_t cq_mask;
+
+  // SQEs handed out but not yet submitted.
+  uint32_t to_submit = 0;
+
+  // Own requests that failed (see reap) and the error of the last one.
+  uint64_t own_failures = 0;
+  int own_error = 0;
+
+  // Provided buffers (see provide_buffers).
+  std::unique_ptr<uint8_t[]> buf_memory;
+  size_t buf_size = 0;
+  uint16_t buf_group = 0;
+
+  int enter(uint32_t submit, uint32_t wait, uint32_t flags);
+  void release();
+
+  // Hand completions to f until it returns true, waiting for more as needed.
+  // Only for when nothing else is in flight.
+  template <typename F>
+  void wait_until(F&& f);
+public:
+  // User data of the ring's own requests, whose completions reap skips.
+  static constexpr uint64_t OWN_DATA = ~uint64_t{0};
+
+  // Throws UringError when the kernel has no io_uring (or forbids it).
+  explicit IoUring(uint32_t entries);
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // A zeroed SQE to fill, submitting those so far first if the queue is full.
+  io_uring_sqe* sqe();
+
+  // Submit what has been filled and wait for at least wait completions.
+  void submit(uint32_t wait = 0);
+
+  // Call f with every completion there is, returns how many there were.
+  // Those of own requests only come when they fail and are counted.
+  template <typename F>
+  size_t reap(F&& f)
+  {
+    uint32_t head = *cq_head;
+    uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes[head & cq_mask];
+      if (cqe.user_data != OWN_DATA) {
+        f(cqe);
+        ++count;
+      } else if (cqe.res < 0) {
+        ++own_failures;
+        own_error = -cqe.res;
+      }
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  // Pin these buffers for WRITE_FIXED, replacing those registered before.
+  void register_buffers(std::span<const iovec> buffers);
+
+  // Set up count buffers of size bytes for receives of buffer group group to
+  // pick from.
+  void provide_buffers(uint16_t group, uint16_t count, size_t size);
+
+  // Bytes a receive put in provided buffer id, to be handed back with recycle
+  // (which takes effect with the next submit).
+  std::span<const uint8_t> provided(uint16_t id, size_t len) const
+  {
+    return {buf_memory.get() + id * buf_size, len};
+  }
+
+  void recycle(uint16_t id);
+
+  // Throws UringError unless a multishot receive into the provided buffers
+  // works and successful completions can be skipped, as recycle does.
+  void probe();
+
+  uint64_t failures() const
+  {
+    return own_failures;
+  }
+
+  int last_error() const
+  {
+    return own_error;
+  }
+};
+
+// Filling SQEs.
+
+inline void prep_accept(io_uring_sqe* sqe, int fd, uint64_t data)
+{
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->user_data = data;
+}
+
+// Keep receiving into buffers of the group until the connection ends.
+inline void prep_recv_multishot(io_uring_sqe* sqe, int fd, uint16_t group, uint64_t data)
+{
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  sqe->user_data = data;
+}
+
+inline void prep_sendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, uint64_t data)
+{
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = data;
+}
+
+// Cancel the request with user data target (it completes with -ECANCELED).
+inline void prep_cancel(io_uring_sqe* sqe, uint64_t target, uint64_t data)
+{
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = target;
+  sqe->user_data = data;
+}
+
+// Complete (with -ETIME) once the time has passed, ts must live until then.
+inline void prep_timeout(io_uring_sqe* sqe, const __kernel_timespec* ts, uint64_t data)
+{
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(ts);
+  sqe->len = 1;
+  sqe->user_data = data;
+}
+
+// Write from registered buffer index (bytes must lie within it).
+inline void prep_write_fixed(io_uring_sqe* sqe, int fd, std::span<const uint8_t> bytes,
+                             uint16_t index, uint64_t data)
+{
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(bytes.data());
+  sqe->len = static_cast<uint32_t>(bytes.size());
+  // Sockets have no file position.
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->buf_index = index;
+  sqe->user_data = data;
+}
+
+#endif  // _URING_H_